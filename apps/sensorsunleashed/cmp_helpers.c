@@ -33,7 +33,6 @@
 #include "cmp_helpers.h"
 #include "crc16.h"
 #include <string.h>
-#include <stdio.h>
 #include "cfs/cfs.h"
 /*
  *
@@ -87,21 +86,10 @@ uint32_t cp_encodemessage(uint8_t msgid, enum req_cmd cmd, void* payload, char l
 	return (uint32_t)((void*)buffer - (void*)buffer_start);
 }
 
-//Used to read from msgpacked buffer
-static bool buf_reader(cmp_ctx_t *ctx, void *data, uint32_t limit) {
-	for(uint32_t i=0; i<limit; i++){
-		*((char*)data++) = *((char*)ctx->buf++);
-	}
-	return true;
-}
-
-
-static uint32_t buf_writer(cmp_ctx_t* ctx, const void *data, uint32_t count){
-	for(uint32_t i=0; i<count; i++){
-		*((uint8_t*)ctx->buf++) = *((char*)data++);
-	}
-	return count;
-}
+/* Worst case lengths of the encoded values, used as the bound when encoding */
+#define OBJECT_MAXLEN		9		//Marker and a 64bit value
+#define ARRAY_MAXLEN(n, w)	(5 + (n) * (w))	//Marker, 32bit size and n values of w bytes
+#define STRING_MAXLEN(n)	(5 + (n))
 
 /*
  * MsgPack Encode the resourceconfiguration message
@@ -182,24 +170,29 @@ static uint32_t buf_writer(cmp_ctx_t* ctx, const void *data, uint32_t count){
 
 //Returns the length of the written data
 uint32_t cp_encodeObject(uint8_t* buffer, cmp_object_t *obj){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, 0, buf_writer);
+	mem_open(&mem, buffer, OBJECT_MAXLEN);
+	cmp_init(&cmp, &mem, 0, mem_writer);
 	cmp_write_object(&cmp, obj);
-	return (uint32_t)((void*)cmp.buf - (void*)buffer);
+	return mem_used(&mem, buffer);
 }
 
 /*
  * Read a cmp object
  * Param:
+ * 	size = Bytes available in the buffer
  * 	obj = result ID
  * 	len = How far did we read into the buffer
  *
  * */
-int cp_decodeObject(uint8_t* buffer, cmp_object_t *obj, uint32_t* len){
+int cp_decodeObject(const uint8_t* buffer, uint32_t size, cmp_object_t *obj, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, buf_reader, 0);
+	mem_open(&mem, buffer, size);
+	cmp_init(&cmp, &mem, mem_reader, 0);
 	if(cmp_read_object(&cmp, obj)){
-		*len = (void*)cmp.buf - (void*)buffer;
+		*len = mem_used(&mem, buffer);
 		return 0;
 	}
 
@@ -207,79 +200,96 @@ int cp_decodeObject(uint8_t* buffer, cmp_object_t *obj, uint32_t* len){
 }
 
 uint32_t cp_encodeU8(uint8_t* buffer, uint8_t val, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, 0, buf_writer);
+	mem_open(&mem, buffer, OBJECT_MAXLEN);
+	cmp_init(&cmp, &mem, 0, mem_writer);
 	cmp_write_u8(&cmp, val);
-	*len += (uint8_t*)cmp.buf - buffer;
+	*len += mem_used(&mem, buffer);
 	return 0;
 }
 
 uint32_t cp_encodeU8Array(uint8_t* buffer, uint8_t* data, uint32_t size, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, 0, buf_writer);
+	mem_open(&mem, buffer, ARRAY_MAXLEN(size, 2));
+	cmp_init(&cmp, &mem, 0, mem_writer);
 
 	cmp_write_array(&cmp, size);
 	for(int i=0; i<size; i++){
 		cmp_write_u8(&cmp, *(data+i));
 	}
-	*len += (uint8_t*)cmp.buf - buffer;
+	*len += mem_used(&mem, buffer);
 	return 0;
 }
 
 uint32_t cp_encodeU16Array(uint8_t* buffer, uint16_t* data, uint32_t size, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, 0, buf_writer);
+	mem_open(&mem, buffer, ARRAY_MAXLEN(size, 3));
+	cmp_init(&cmp, &mem, 0, mem_writer);
 
 	cmp_write_array(&cmp, size);
-	for(int i=0; i<8; i++){
+	for(int i=0; i<size; i++){
 		cmp_write_u16(&cmp, *(data+i));
 	}
-	*len += (uint8_t*)cmp.buf - buffer;
+	*len += mem_used(&mem, buffer);
 	return 0;
 }
 
 
 uint32_t cp_encodeString(uint8_t* buffer, char* str, uint32_t size, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, 0, buf_writer);
+	mem_open(&mem, buffer, STRING_MAXLEN(size));
+	cmp_init(&cmp, &mem, 0, mem_writer);
 
 	cmp_write_str(&cmp, str, size);
 
-	*len += (uint8_t*)cmp.buf - buffer;
+	*len += mem_used(&mem, buffer);
 	return 0;
 }
 
 /*
  * Read the Message ID
  * Param:
+ * 	size = Bytes available in the buffer
  * 	x = result ID
  * 	len = How far did we read into the buffer
  *
  * */
-int cp_decodeU8(const uint8_t* buffer, uint8_t* x, uint32_t* len){
+int cp_decodeU8(const uint8_t* buffer, uint32_t size, uint8_t* x, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, (uint8_t*)buffer, buf_reader, 0);
+	mem_open(&mem, buffer, size);
+	cmp_init(&cmp, &mem, mem_reader, 0);
 
 	if(cmp_read_uchar(&cmp, x)){
-		*len = (void*)cmp.buf - (void*)buffer;
+		*len = mem_used(&mem, buffer);
 		return 0;
 	}
 
 	return 1;
 }
 
+//arrlen is the number of values there is room for in arr
 //Return 1 for error
 //Return 0 for success
-int cp_decodeS8Array(uint8_t* buffer, int8_t* arr, uint32_t* len){
+int cp_decodeS8Array(const uint8_t* buffer, uint32_t size, int8_t* arr, uint32_t arrlen, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, buf_reader, 0);
-	uint32_t size;
+	mem_open(&mem, buffer, size);
+	cmp_init(&cmp, &mem, mem_reader, 0);
+	uint32_t count;
 	int ret = 0;
 
-	if(cmp_read_array(&cmp, &size)){    //Returns the number of single bytes in the array
-		while(size){
+	if(!cmp_read_array(&cmp, &count) || count > arrlen){
+		ret = 1;
+	}
+	else{
+		while(count){
 			if(cmp_read_s8(&cmp, arr++)){
-				size -= 1;
+				count -= 1;
 			}
 			else{
 				ret = 1;
@@ -288,33 +298,37 @@ int cp_decodeS8Array(uint8_t* buffer, int8_t* arr, uint32_t* len){
 		}
 	}
 
-	*len += (uint8_t*)cmp.buf - buffer;
+	*len += mem_used(&mem, buffer);
 	return ret;
 }
 
 
+//The array size is the number of bytes, not the number of values
+//arrlen is the number of values there is room for in arr
 //Return -1 for error
 //Return arraysize for success
-int cp_decodeU16Array(uint8_t* buffer, uint16_t* arr, uint32_t* len){
+int cp_decodeU16Array(const uint8_t* buffer, uint32_t size, uint16_t* arr, uint32_t arrlen, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, buf_reader, 0);
-	uint32_t size;
+	mem_open(&mem, buffer, size);
+	cmp_init(&cmp, &mem, mem_reader, 0);
+	uint32_t count;
 	int ret = 0;
 
-	if(cmp_read_array(&cmp, &size)){    //Returns the number of single bytes in the array
-		while(size){
-			if(cmp_read_u16(&cmp, arr++)){
-				size -= 2;
-				ret++;
-			}
-			else{
-				ret = -1;
-				break;
-			}
+	if(!cmp_read_array(&cmp, &count)){
+		ret = -1;
+	}
+	while(ret >= 0 && count){
+		if(ret < arrlen && cmp_read_u16(&cmp, arr++)){
+			count = count > 2 ? count - 2 : 0;
+			ret++;
+		}
+		else{
+			ret = -1;
 		}
 	}
 
-	*len += (uint8_t*)cmp.buf - buffer;
+	*len += mem_used(&mem, buffer);
 	return ret;
 }
 
@@ -324,95 +338,170 @@ int cp_decodeU16Array(uint8_t* buffer, uint16_t* arr, uint32_t* len){
 //len will be the index of where we read to
 //Returns 0 if success
 //Returns 1 if error
-int cp_decode_string(uint8_t* buffer, char* string, uint32_t* stringlen, uint32_t* len){
+int cp_decode_string(const uint8_t* buffer, uint32_t size, char* string, uint32_t* stringlen, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, buf_reader, 0);
+	mem_open(&mem, buffer, size);
+	cmp_init(&cmp, &mem, mem_reader, 0);
 	int ret = 1;
 	if(cmp_read_str(&cmp, string, stringlen)){
 		ret = 0;
 	}
-	*len += (uint8_t*)cmp.buf - buffer;
+	*len += mem_used(&mem, buffer);
 	return ret;
 }
 
+/*
+ * Write v as decimal digits, ending just before p and with at least
+ * mindigits digits. Returns the first digit.
+ * 64bit division is a library call on the Cortex-M3, so it is only
+ * used until the rest of the value fits in 32bit.
+ * */
+static char* putDigits(char* p, uint64_t v, int mindigits){
+	while(v > UINT32_MAX){
+		*--p = '0' + v % 10;
+		v /= 10;
+		mindigits--;
+	}
+
+	uint32_t v32 = (uint32_t)v;
+	do{
+		*--p = '0' + v32 % 10;
+		v32 /= 10;
+		mindigits--;
+	}while(v32 || mindigits > 0);
+
+	return p;
+}
+
+/*
+ * Format value/resolution in fixed point, with as many decimals as it
+ * takes to show a step of the resolution, ex. 1234 at resolution 100
+ * is "12.34". Returns the string length.
+ * */
+static uint32_t formatFixed(char* result, uint64_t value, int negative, uint32_t resolution){
+	char tmp[CP_STRING_MAXLEN];
+	char* p = tmp + sizeof(tmp);
+	uint64_t whole = value;
+	uint32_t scale = 1;
+	int decimals = 0;
+
+	if(resolution > 1){
+		while(scale < resolution && decimals < 9){
+			scale *= 10;
+			decimals++;
+		}
+		whole = value / resolution;
+		p = putDigits(p, (uint64_t)(value % resolution) * scale / resolution, decimals);
+		*--p = '.';
+	}
+	p = putDigits(p, whole, 1);
+	if(negative){
+		*--p = '-';
+	}
+
+	uint32_t n = tmp + sizeof(tmp) - p;
+	memcpy(result, p, n);
+	result[n] = 0;
+	return n;
+}
+
+#define FLOAT_DECIMALS_SCALE	1000	//Floats are shown with 3 decimals
+
+static int formatFloat(char* result, double d, uint32_t resolution, uint32_t* len){
+	if(d != d){
+		strcpy(result, "nan");
+		*len += 3;
+		return 0;
+	}
+
+	if(resolution > 1){
+		d /= resolution;
+	}
+	int negative = d < 0;
+	d = negative ? -d : d;
+	if(d >= 1e15){		//Too large for the fixed point, and inf
+		strcpy(result, negative ? "-inf" : "inf");
+		*len += negative ? 4 : 3;
+		return 0;
+	}
+
+	uint64_t v = (uint64_t)(d * FLOAT_DECIMALS_SCALE + 0.5);
+	*len += formatFixed(result, v, negative && v > 0, FLOAT_DECIMALS_SCALE);
+	return 0;
+}
+
 /*
  * Convert an messagepack object to a char string
  * Parameter:
  * 	obj:	The object to convert
- * 	result: The resulting char buffer
- * 	len: 	String length without trailing '\0' (Note its not initialized - has to be done from the caller)
+ * 	resolution: The value is shown as value/resolution, see struct resourceconf. 0 or 1 is unscaled
+ * 	result: The resulting char buffer, has to have room for CP_STRING_MAXLEN
+ * 	len: 	String length without trailing '\0' is added (Note its not initialized - has to be done from the caller)
  *
  *  Returns:
  *  0 for OK
  *  1 for err
  *
  * */
-int cp_cmp_to_string(cmp_object_t* obj, uint8_t* result, uint32_t* len){
+int cp_cmp_to_string_scaled(const cmp_object_t* obj, uint32_t resolution, uint8_t* result, uint32_t* len){
+	char* str = (char*)result;
+	int64_t s;
 
 	switch(obj->type){
-	case CMP_TYPE_POSITIVE_FIXNUM:
 	case CMP_TYPE_NIL:	// NULL = 0
-	case CMP_TYPE_UINT8:
-		*len += sprintf((char*)result, "%u", obj->as.u8);
-		break;
+		*len += formatFixed(str, 0, 0, resolution);
+		return 0;
 	case CMP_TYPE_BOOLEAN:
-		*len += sprintf((char*)result, "%u", obj->as.boolean);
-		break;
-	case CMP_TYPE_FLOAT:
-	case CMP_TYPE_DOUBLE:
-		*len += sprintf((char*)result, "%f", obj->as.dbl);
-		break;
+		*len += formatFixed(str, obj->as.boolean != 0, 0, 1);
+		return 0;
+	case CMP_TYPE_POSITIVE_FIXNUM:
+	case CMP_TYPE_UINT8:
+		*len += formatFixed(str, obj->as.u8, 0, resolution);
+		return 0;
 	case CMP_TYPE_UINT16:
-		*len += sprintf((char*)result, "%u", obj->as.u16);
-		break;
+		*len += formatFixed(str, obj->as.u16, 0, resolution);
+		return 0;
 	case CMP_TYPE_UINT32:
-		*len += sprintf((char*)result, "%lu", obj->as.u32);
-		break;
+		*len += formatFixed(str, obj->as.u32, 0, resolution);
+		return 0;
 	case CMP_TYPE_UINT64:
-		*len += sprintf((char*)result, "%Lu", obj->as.u64);
-		break;
+		*len += formatFixed(str, obj->as.u64, 0, resolution);
+		return 0;
 	case CMP_TYPE_SINT8:
 	case CMP_TYPE_NEGATIVE_FIXNUM:
-		*len += sprintf((char*)result, "%d", obj->as.s8);
+		s = obj->as.s8;
 		break;
 	case CMP_TYPE_SINT16:
-		*len += sprintf((char*)result, "%d", obj->as.s16);
+		s = obj->as.s16;
 		break;
 	case CMP_TYPE_SINT32:
-		*len = sprintf((char*)result, "%ld", obj->as.s32);
+		s = obj->as.s32;
 		break;
 	case CMP_TYPE_SINT64:
-		*len += sprintf((char*)result, "%Ld", obj->as.s64);
+		s = obj->as.s64;
 		break;
-	case CMP_TYPE_FIXMAP:
-	case CMP_TYPE_FIXARRAY:
-	case CMP_TYPE_FIXSTR:
-	case CMP_TYPE_BIN8:
-	case CMP_TYPE_BIN16:
-	case CMP_TYPE_BIN32:
-	case CMP_TYPE_EXT8:
-	case CMP_TYPE_EXT16:
-	case CMP_TYPE_EXT32:
-	case CMP_TYPE_FIXEXT1:
-	case CMP_TYPE_FIXEXT2:
-	case CMP_TYPE_FIXEXT4:
-	case CMP_TYPE_FIXEXT8:
-	case CMP_TYPE_FIXEXT16:
-	case CMP_TYPE_STR8:
-	case CMP_TYPE_STR16:
-	case CMP_TYPE_STR32:
-	case CMP_TYPE_ARRAY16:
-	case CMP_TYPE_ARRAY32:
-	case CMP_TYPE_MAP16:
-	case CMP_TYPE_MAP32:
+	case CMP_TYPE_FLOAT:
+		return formatFloat(str, obj->as.flt, resolution, len);
+	case CMP_TYPE_DOUBLE:
+		return formatFloat(str, obj->as.dbl, resolution, len);
+	default:
 		return 1;
 	}
+
+	//The magnitude of INT64_MIN does not fit an int64_t
+	*len += formatFixed(str, s < 0 ? 0 - (uint64_t)s : (uint64_t)s, s < 0, resolution);
 	return 0;
 }
 
+int cp_cmp_to_string(cmp_object_t* obj, uint8_t* result, uint32_t* len){
+	return cp_cmp_to_string_scaled(obj, 1, result, len);
+}
+
 /* Convert the device readingspayload to a string.
  * Parameter:
  * 	buffer: Raw messagepacked buffer
+ * 	size: Bytes available in the buffer
  * 	conv: String result
  * 	len: String length without trailing '\0' (Note its not initialized - has to be done from the caller)
  * 	TODO: Consider changing the len, to how far we read the buffer instead.
@@ -421,9 +510,11 @@ int cp_cmp_to_string(cmp_object_t* obj, uint8_t* result, uint32_t* len){
  *  0 for OK
  *  1 for err
  */
-int cp_convMsgPackToString(uint8_t* buffer, uint8_t* conv, uint32_t* len){
+int cp_convMsgPackToString(const uint8_t* buffer, uint32_t size, uint8_t* conv, uint32_t* len){
+	struct mem_s mem;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, buffer, buf_reader, 0);
+	mem_open(&mem, buffer, size);
+	cmp_init(&cmp, &mem, mem_reader, 0);
 
 	cmp_object_t obj;
 	if(!cmp_read_object(&cmp, &obj)){
@@ -433,12 +524,90 @@ int cp_convMsgPackToString(uint8_t* buffer, uint8_t* conv, uint32_t* len){
 	return cp_cmp_to_string(&obj, conv, len);
 }
 
+/*
+ * Open a file and setup the context
+ * Returns the file descriptor, negative on error
+ * */
+int file_open(struct file_s* file, const char* name, int flags){
+	file->fd = cfs_open(name, flags);
+	file->offset = 0;
+	file->writing = 0;
+	file->pos = 0;
+	file->len = 0;
+	return file->fd;
+}
+
+/*
+ * Write the pending data
+ * Returns 0 on success
+ * */
+int file_flush(struct file_s* file){
+	int ret = 0;
+	if(file->writing && file->len > 0){
+		if(cfs_write(file->fd, file->block, file->len) != file->len){
+			ret = 1;
+		}
+	}
+	file->writing = 0;
+	file->pos = 0;
+	file->len = 0;
+	return ret;
+}
+
+/* Write the pending data and start over from the beginning of the file.
+ * Returns 0 on success */
+int file_rewind(struct file_s* file){
+	return file_seek(file, 0);
+}
+
+/* Write the pending data and move to offset, the block is dropped.
+ * Returns 0 on success */
+int file_seek(struct file_s* file, int offset){
+	int ret = file_flush(file);
+	if(cfs_seek(file->fd, offset, CFS_SEEK_SET) != offset){
+		return 1;
+	}
+	file->offset = offset;
+	return ret;
+}
+
+void file_close(struct file_s* file){
+	if(file->fd < 0) return;
+	file_flush(file);
+	cfs_close(file->fd);
+	file->fd = -1;
+}
+
 bool file_reader(cmp_ctx_t *ctx, void *data, uint32_t len) {
 
 	struct file_s* file = (struct file_s*)ctx->buf;
-	if(file->fd >= 0) {
-		cfs_seek(file->fd, file->offset, CFS_SEEK_SET);
-		file->offset += cfs_read(file->fd, data, len);
+	uint8_t* dst = (uint8_t*)data;
+	int read;
+	if(file->fd < 0) return false;
+	if(file->writing && file_flush(file) != 0) return false;
+
+	while(len > 0){
+		if(file->pos == file->len){
+			if(len >= FILE_BLOCKSIZE){
+				//Large reads are done directly
+				read = cfs_read(file->fd, dst, len);
+				if(read <= 0) return false;
+				file->offset += read;
+				return (uint32_t)read == len;	//A short read is the end of the file
+			}
+			read = cfs_read(file->fd, file->block, FILE_BLOCKSIZE);
+			if(read <= 0) return false;
+			file->pos = 0;
+			file->len = read;
+		}
+
+		uint32_t n = file->len - file->pos;
+		if(n > len) n = len;
+		memcpy(dst, &file->block[file->pos], n);
+		file->pos += n;
+		file->offset += n;
+		dst += n;
+		len -= n;
 	}
 
 	return true;
@@ -447,11 +616,70 @@ bool file_reader(cmp_ctx_t *ctx, void *data, uint32_t len) {
 uint32_t file_writer(cmp_ctx_t* ctx, const void *data, uint32_t len){
 
 	struct file_s* file = (struct file_s*)ctx->buf;
+	if(file->fd < 0) return len;
+
+	if(!file->writing){
+		//Data read ahead has to be given back, before writing
+		if(file->pos < file->len){
+			cfs_seek(file->fd, file->pos - file->len, CFS_SEEK_CUR);
+		}
+		file->writing = 1;
+		file->pos = 0;
+		file->len = 0;
+	}
 
-	if(file->fd >= 0) {
-		len = cfs_write(file->fd, data, len);
+	if(file->len + len > FILE_BLOCKSIZE){
+		if(file_flush(file) != 0) return 0;
+		file->writing = 1;
 	}
 
+	if(len >= FILE_BLOCKSIZE){
+		int written = cfs_write(file->fd, data, len);
+		if(written < 0) return 0;
+		len = written;
+	}
+	else{
+		memcpy(&file->block[file->len], data, len);
+		file->len += len;
+	}
+	file->offset += len;
+
 	return len;
 }
 
+void mem_open(struct mem_s* mem, const void* buffer, uint32_t size){
+	mem->ptr = (uint8_t*)buffer;
+	mem->end = mem->ptr + size;
+	mem->error = 0;
+}
+
+/* Bytes read or written since the start of buffer */
+uint32_t mem_used(const struct mem_s* mem, const void* buffer){
+	return mem->ptr - (const uint8_t*)buffer;
+}
+
+bool mem_reader(cmp_ctx_t *ctx, void *data, uint32_t len){
+
+	struct mem_s* mem = (struct mem_s*)ctx->buf;
+	if(len > (uint32_t)(mem->end - mem->ptr)){
+		mem->error = 1;
+		return false;
+	}
+
+	memcpy(data, mem->ptr, len);
+	mem->ptr += len;
+	return true;
+}
+
+uint32_t mem_writer(cmp_ctx_t* ctx, const void *data, uint32_t len){
+
+	struct mem_s* mem = (struct mem_s*)ctx->buf;
+	if(len > (uint32_t)(mem->end - mem->ptr)){
+		mem->error = 1;
+		return 0;
+	}
+
+	memcpy(mem->ptr, data, len);
+	mem->ptr += len;
+	return len;
+}
@@ -95,9 +95,41 @@ struct resourceconf{
 	//uint8_t notation;		//Qm.f => MMMM.FFFF	eg. Q1.29 = int32_t with 1 integer bit and 29 fraction bits, Q32 = uint32_t = 32 positive integer bits. Q31 is a int32_t
 };
 
+/*
+ * File context for cmp. Reads are done a block at a time and served
+ * from the block, and writes are collected in the block and written
+ * when it is full or the file is flushed/closed. This way cmp reading
+ * a value byte by byte, does not end up as a cfs call per byte.
+ * Always use file_open and file_close, as writes are pending until
+ * the file is flushed.
+ * */
+#ifdef CMP_CONF_FILE_BLOCKSIZE
+#define FILE_BLOCKSIZE	CMP_CONF_FILE_BLOCKSIZE
+#else
+#define FILE_BLOCKSIZE	32
+#endif
+#if FILE_BLOCKSIZE > 0xFFFF
+#error "FILE_BLOCKSIZE must fit the uint16_t block index"
+#endif
+
 struct file_s{
-	int offset;
+	int offset;		//Bytes read or written through the context
 	int fd;
+	uint8_t writing;	//The block holds data waiting to be written
+	uint16_t pos;	//Next byte to read from the block
+	uint16_t len;	//Bytes in the block
+	uint8_t block[FILE_BLOCKSIZE];
+};
+
+/*
+ * Memory context for cmp. Reads and writes are copied a block at a time,
+ * and never goes past end; if they would, nothing is copied, error is
+ * set and cmp fails the read or write.
+ * */
+struct mem_s{
+	uint8_t* ptr;	//Next byte to read or write
+	uint8_t* end;	//First byte after the buffer
+	uint8_t error;	//A read or write was past the end
 };
 
 int cp_decodemessage(char* source, int len, rx_msg* destination);
@@ -111,15 +143,29 @@ uint32_t cp_encodeU16Array(uint8_t* buffer, uint16_t* data, uint32_t size, uint3
 uint32_t cp_encodeString(uint8_t* buffer, char* str, uint32_t size, uint32_t* len);
 
 int cp_decoderesource_conf(struct resourceconf* data, uint8_t* buffer, char* strings);
-int cp_decodeU8(const uint8_t* buffer, uint8_t* x, uint32_t* len);
-int cp_decodeS8Array(uint8_t* buffer, int8_t* arr, uint32_t* len);
-int cp_decodeU16Array(uint8_t* buffer, uint16_t* arr, uint32_t* len);
-int cp_decode_string(uint8_t* buffer, char* string, uint32_t* stringlen, uint32_t* len);
-int cp_decodeObject(uint8_t* buffer, cmp_object_t *obj, uint32_t* len);
+int cp_decodeU8(const uint8_t* buffer, uint32_t size, uint8_t* x, uint32_t* len);
+int cp_decodeS8Array(const uint8_t* buffer, uint32_t size, int8_t* arr, uint32_t arrlen, uint32_t* len);
+int cp_decodeU16Array(const uint8_t* buffer, uint32_t size, uint16_t* arr, uint32_t arrlen, uint32_t* len);
+int cp_decode_string(const uint8_t* buffer, uint32_t size, char* string, uint32_t* stringlen, uint32_t* len);
+int cp_decodeObject(const uint8_t* buffer, uint32_t size, cmp_object_t *obj, uint32_t* len);
 
-int cp_cmp_to_string(cmp_object_t* obj, uint8_t* result, uint32_t* len);
-int cp_convMsgPackToString(uint8_t* buffer, uint8_t* conv, uint32_t* len);
+/* Longest string from cp_cmp_to_string, including the '\0' */
+#define CP_STRING_MAXLEN	24
 
+int cp_cmp_to_string(cmp_object_t* obj, uint8_t* result, uint32_t* len);
+int cp_cmp_to_string_scaled(const cmp_object_t* obj, uint32_t resolution, uint8_t* result, uint32_t* len);
+int cp_convMsgPackToString(const uint8_t* buffer, uint32_t size, uint8_t* conv, uint32_t* len);
+
+void mem_open(struct mem_s* mem, const void* buffer, uint32_t size);
+uint32_t mem_used(const struct mem_s* mem, const void* buffer);
+bool mem_reader(cmp_ctx_t *ctx, void *data, uint32_t len);
+uint32_t mem_writer(cmp_ctx_t* ctx, const void *data, uint32_t len);
+
+int file_open(struct file_s* file, const char* name, int flags);
+int file_flush(struct file_s* file);
+int file_rewind(struct file_s* file);
+int file_seek(struct file_s* file, int offset);
+void file_close(struct file_s* file);
 bool file_reader(cmp_ctx_t *ctx, void *data, uint32_t len);
 uint32_t file_writer(cmp_ctx_t* ctx, const void *data, uint32_t len);
 
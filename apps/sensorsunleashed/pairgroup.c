@@ -30,66 +30,132 @@
  * This file is part of the Sensors Unleashed project
  *******************************************************************************/
 
-#include <malloc.h>
+#include <string.h>
 #include "pairgroup.h"
+#include "urltable.h"
+#include "poolstats.h"
 
-LIST(groupslist);
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
 
-/* 10 groups which each can contain 20 pairs */
-MEMB(groupslist_memb, pairgroup_t, 10);
-MEMB(pairgroupitem_memb, pairgroupItem_t, 20);
+/*
+ * The groups are indexed by a hash of the destination address, the
+ * shared url and the event, with open addressing and linear probing
+ * as in peertable.c. A slot points to the group, NULL is an empty slot.
+ * */
+#define PAIRGROUP_MASK	(PAIRGROUP_TABLE_SIZE - 1)
+
+POOL(groupslist_memb, pairgroup_t, PAIRGROUPS_MAX);
+POOL(pairgroupitem_memb, pairgroupItem_t, PAIRGROUP_ITEMS_MAX);
 
-static pairgroup_t* pairGroupNew(enum su_basic_events triggerindex){
-	pairgroup_t* g = memb_alloc(&groupslist_memb);
-	if(g != 0){
-		g->paired = 0;
-		g->triggerindex = triggerindex;
-		LIST_STRUCT_INIT(g, pairgroup);
-		list_add(groupslist, g);
+static pairgroup_t* slots[PAIRGROUP_TABLE_SIZE];
+
+static const char* eventSuffix(enum su_basic_events event){
+	switch(event){
+	case aboveEvent: return strAbove;
+	case belowEvent: return strBelow;
+	case changeEvent: return strChange;
+	default: return strEvents;
 	}
+}
 
-	return g;
+/* Urls are shared, so the pointer identifies the url */
+static uint8_t pairGroupHash(joinpair_t* pair, enum su_basic_events event){
+	uint16_t h = pair->destip.u16[4] ^ pair->destip.u16[5] ^ pair->destip.u16[6] ^ pair->destip.u16[7];
+	h ^= (uint16_t)(uintptr_t)pair->dsturl;
+	h ^= (uint16_t)event << 12;
+	h = (uint16_t)(h * 0x9E37);
+	return (h >> 8) & PAIRGROUP_MASK;
 }
 
 //Return 0 on match
-static int comparePairLink(joinpair_t* p1, joinpair_t* p2, enum su_basic_events event){
-
-	if(memcmp(p1->destip.u8, p2->destip.u8, 16) != 0) return 1;
+static int comparePairLink(pairgroup_t* g, joinpair_t* pair, enum su_basic_events event){
+	pairgroupItem_t* item = list_head(g->pairgroup);
 
-	if(event == aboveEvent){
-		if(strcmp(p1->dsturlAbove, p2->dsturlAbove) != 0) return 1;
-	}
-	else if(event == belowEvent){
-		if(strcmp(p1->dsturlBelow, p2->dsturlBelow) != 0) return 1;
-	}
-	else if(event == changeEvent){
-		if(strcmp(p1->dsturlChange, p2->dsturlChange) != 0) return 1;
-	}
+	if(g->triggerindex != event) return 1;
+	if(item->pair->dsturl != pair->dsturl) return 1;
+	if(memcmp(item->pair->destip.u8, pair->destip.u8, 16) != 0) return 1;
 
 	return 0;
 }
 
-void pairGroupInit(){
-	list_init(groupslist);
-	memb_init(&groupslist_memb);
+/* Return the slot of the group the pair belongs to for event, or -1 */
+static int pairGroupSlot(joinpair_t* pair, enum su_basic_events event){
+	uint8_t i = pairGroupHash(pair, event);
+
+	for(int n=0; n<PAIRGROUP_TABLE_SIZE; n++){
+		if(slots[i] == NULL) return -1;
+		if(comparePairLink(slots[i], pair, event) == 0) return i;
+		i = (i + 1) & PAIRGROUP_MASK;
+	}
+	return -1;
 }
 
-/*
- * Returns NULL if we have no link
- * Returns ptr to the group in should be included in
- * */
-static pairgroup_t* pairGroupContainsLink(joinpair_t* pair, enum su_basic_events event){
+static pairgroup_t* pairGroupNew(joinpair_t* pair, enum su_basic_events triggerindex){
+	pairgroup_t* g = poolAlloc(&groupslist_memb_pool);
+	if(g == 0){
+		PRINTF("No more pair groups\n");
+		return 0;
+	}
 
-	for(pairgroup_t* g = list_head(groupslist); g; g = list_item_next(g)){
-		if(g->triggerindex == event){
-			pairgroupItem_t* item = list_head(g->pairgroup);
-			if(comparePairLink(item->pair, pair, event) == 0){
-				return g;
-			}
+	g->uri = urlInternSuffix(pair->dsturl, eventSuffix(triggerindex));
+	if(g->uri == NULL){
+		memb_free(&groupslist_memb, g);
+		return 0;
+	}
+	g->paired = 0;
+	g->obs = NULL;
+	g->triggerindex = triggerindex;
+	g->hash = pairGroupHash(pair, triggerindex);
+	LIST_STRUCT_INIT(g, pairgroup);
+
+	uint8_t i = g->hash;
+	while(slots[i] != NULL){	//There is always a free slot, as PAIRGROUP_TABLE_SIZE > PAIRGROUPS_MAX
+		i = (i + 1) & PAIRGROUP_MASK;
+	}
+	slots[i] = g;
+
+	return g;
+}
+
+static void pairGroupDelete(int i){
+	pairgroup_t* g = slots[i];
+	slots[i] = NULL;
+
+	//Move the following entries back, if their probe sequence passes the hole
+	int j = i;
+	while(1){
+		j = (j + 1) & PAIRGROUP_MASK;
+		if(slots[j] == NULL) break;
+
+		int h = slots[j]->hash;
+		int move = (j > i) ? (h <= i || h > j) : (h <= i && h > j);
+		if(move){
+			slots[i] = slots[j];
+			slots[j] = NULL;
+			i = j;
 		}
 	}
 
-	return 0;
+	//The observee points to the url and the group, it must go first
+	if(g->obs != NULL){
+		coap_obs_remove_observee(g->obs);
+	}
+	urlRelease(g->uri);
+	memb_free(&groupslist_memb, g);
+}
+
+void pairGroupInit(){
+	memb_init(&groupslist_memb);
+	memb_init(&pairgroupitem_memb);
+	poolRegister(&groupslist_memb_pool);
+	poolRegister(&pairgroupitem_memb_pool);
+	memset(slots, 0, sizeof(slots));
 }
 
 static int pairGroupHasPair(pairgroup_t* g, joinpair_t* pair){
@@ -101,19 +167,32 @@ static int pairGroupHasPair(pairgroup_t* g, joinpair_t* pair){
 	return 0;
 }
 
+/*
+ * Returns the group the pair was added to
+ * Returns NULL if there is no room for the pair
+ * */
 pairgroup_t* pairGroupAdd(joinpair_t* pair, enum su_basic_events event){
 
-	pairgroup_t* g = pairGroupContainsLink(pair, event);
-	if(g != 0){
+	pairgroup_t* g = 0;
+	int i = pairGroupSlot(pair, event);
+	if(i >= 0){
+		g = slots[i];
 		if(pairGroupHasPair(g, pair)) return g;
 	}
 
-	pairgroupItem_t* item = memb_alloc(&pairgroupitem_memb);
+	pairgroupItem_t* item = poolAlloc(&pairgroupitem_memb_pool);
+	if(item == 0){
+		PRINTF("No more pair group items\n");
+		return 0;
+	}
 	item->pair = pair;
 
 	if(g == 0){
-		g = pairGroupNew(event);
-		if(g == 0) return 0;
+		g = pairGroupNew(pair, event);
+		if(g == 0){
+			memb_free(&pairgroupitem_memb, item);
+			return 0;
+		}
 	}
 
 	list_add(g->pairgroup, item);
@@ -123,12 +202,15 @@ pairgroup_t* pairGroupAdd(joinpair_t* pair, enum su_basic_events event){
 
 
 /*
- * Indications wether a group is gone is done by callbacks
+ * Remove the pair from the group of the event. When the group is empty
+ * it is deleted, and our subscription to its url is cancelled.
+ * Returns the number of pairs left in the group
  * */
 int pairGroupRemove(joinpair_t* pair, enum su_basic_events event){
 
-	pairgroup_t* g = pairGroupContainsLink(pair, event);
-	if(g == 0) return 0;
+	int i = pairGroupSlot(pair, event);
+	if(i < 0) return 0;
+	pairgroup_t* g = slots[i];
 
 	int len = 0;
 	for(pairgroupItem_t* pgi = list_head(g->pairgroup); pgi; pgi = list_item_next(pgi)){
@@ -138,8 +220,7 @@ int pairGroupRemove(joinpair_t* pair, enum su_basic_events event){
 
 			len = list_length(g->pairgroup);
 			if(len == 0){
-				list_remove(groupslist, g);
-				memb_free(&groupslist_memb, g);
+				pairGroupDelete(i);
 			}
 			break;
 		}
@@ -35,6 +35,7 @@
 
 #include "contiki.h"
 #include "pairing.h"
+#include "coap-observe-client.h"
 
 /*
  * To avoid having to parse through urls, group all
@@ -46,10 +47,55 @@
  *	a pairgroup all use the sanme pair from the same node
  */
 
+/*
+ * A pair can be in a group for each of its events, or only in the
+ * combined events group. Most pairs points to a url of their own,
+ * so there is a group for each pair.
+ * */
+#if SUSENSORS_COMBINED_EVENTS
+#define PAIRGROUP_EVENTS	1
+#else
+#define PAIRGROUP_EVENTS	3
+#endif
+
+#ifdef PAIRGROUP_CONF_ITEMS_MAX
+#define PAIRGROUP_ITEMS_MAX		PAIRGROUP_CONF_ITEMS_MAX
+#else
+#define PAIRGROUP_ITEMS_MAX		(PAIRINGS_MAX * PAIRGROUP_EVENTS)
+#endif
+
+#ifdef PAIRGROUP_CONF_GROUPS_MAX
+#define PAIRGROUPS_MAX		PAIRGROUP_CONF_GROUPS_MAX
+#else
+#define PAIRGROUPS_MAX		(PAIRINGS_MAX * PAIRGROUP_EVENTS)
+#endif
+
+/* Number of hash slots, must be a power of 2, larger than PAIRGROUPS_MAX and max 256 */
+#ifdef PAIRGROUP_CONF_TABLE_SIZE
+#define PAIRGROUP_TABLE_SIZE	PAIRGROUP_CONF_TABLE_SIZE
+#elif PAIRGROUPS_MAX < 16
+#define PAIRGROUP_TABLE_SIZE	32
+#elif PAIRGROUPS_MAX < 32
+#define PAIRGROUP_TABLE_SIZE	64
+#elif PAIRGROUPS_MAX < 64
+#define PAIRGROUP_TABLE_SIZE	128
+#else
+#define PAIRGROUP_TABLE_SIZE	256
+#endif
+
+#if PAIRGROUP_TABLE_SIZE <= PAIRGROUPS_MAX
+#error "PAIRGROUP_TABLE_SIZE must be larger than PAIRGROUPS_MAX, the probing needs a free slot"
+#endif
+#if PAIRGROUP_TABLE_SIZE > 256 || (PAIRGROUP_TABLE_SIZE & (PAIRGROUP_TABLE_SIZE - 1)) != 0
+#error "PAIRGROUP_TABLE_SIZE must be a power of 2, and max 256"
+#endif
+
 struct pairgroup_s{
-	struct pairgroup_s *next;
 	uint8_t triggerindex;
 	uint8_t paired;
+	uint8_t hash;		//Home slot in the group table
+	const char* uri;	//The observed url, with the event suffix. Shared, see urltable.h
+	coap_observee_t* obs;	//Our subscription to the url, NULL if not observing
 	LIST_STRUCT(pairgroup);
 };
 
@@ -42,6 +42,11 @@
 #include "net/ipv6/uip.h"
 #include "lib/memb.h"
 #include "rpl.h"
+#include "coap.h"
+#include "peertable.h"
+#include "urltable.h"
+#include "slab.h"
+#include "poolstats.h"
 
 #define DEBUG 1
 #if DEBUG
@@ -55,17 +60,41 @@
 #define PRINTLLADDR(addr)
 #endif
 
-static uint8_t lastid = 0;
-
+/*
+ * A join message is received blockwise. Each join is assembled in its
+ * own session, identified by the address and token of the client, so
+ * that several clients can join at the same time. Sessions that has
+ * been idle for JOIN_SESSION_TIMEOUT are reused.
+ * */
 #define BUFFERSIZE	300
-static uint8_t buffer[BUFFERSIZE] __attribute__ ((aligned (4))) = { 0 };
-static uint32_t bufsize = 0;
 
-MEMB(pairings, joinpair_t, 20);
+#ifdef PAIRINGS_CONF_JOIN_SESSIONS
+#define JOIN_SESSIONS	PAIRINGS_CONF_JOIN_SESSIONS
+#else
+#define JOIN_SESSIONS	2
+#endif
+#define JOIN_SESSION_TIMEOUT	(10 * CLOCK_SECOND)
+
+struct joinsession_s{
+	uint8_t buffer[BUFFERSIZE] __attribute__ ((aligned (4)));
+	uint32_t size;
+	uint8_t used;
+	uint8_t tokenlen;
+	uint8_t token[COAP_TOKEN_LEN];
+	uint32_t nextnum;	//Next block expected
+	clock_time_t lastactive;
+	uip_ip6addr_t addr;
+};
+typedef struct joinsession_s joinsession_t;
+
+static joinsession_t sessions[JOIN_SESSIONS];
+
+POOL(pairings, joinpair_t, PAIRINGS_MAX);
 
 void pairing_init(){
-	//Init dynamic memory	(Default 4096Kb)
-	mmem_init();
+	slab_init();
+	urlTableInit();
+	poolRegister(&pairings_pool);
 }
 
 static void (*pair_add_notify)(joinpair_t*) = 0;
@@ -107,203 +136,688 @@ static int addPrefix(uip_ip6addr_t* ip6addr){
 	return 0;
 }
 
+static joinsession_t* sessionFind(const uip_ip6addr_t* addr, const uint8_t* token, uint8_t tokenlen){
+	for(int i=0; i<JOIN_SESSIONS; i++){
+		joinsession_t* js = &sessions[i];
+		if(js->used && js->tokenlen == tokenlen
+				&& memcmp(&js->addr, addr, 16) == 0
+				&& memcmp(js->token, token, tokenlen) == 0){
+			return js;
+		}
+	}
+	return NULL;
+}
+
+/* Get a free session, or one that has been idle for too long */
+static joinsession_t* sessionAlloc(){
+	for(int i=0; i<JOIN_SESSIONS; i++){
+		joinsession_t* js = &sessions[i];
+		if(!js->used || (clock_time_t)(clock_time() - js->lastactive) > JOIN_SESSION_TIMEOUT){
+			memset(js, 0, sizeof(joinsession_t));
+			js->used = 1;
+			js->lastactive = clock_time();
+			return js;
+		}
+	}
+	return NULL;
+}
+
+static void sessionFree(joinsession_t* js){
+	js->used = 0;
+}
+
 //Return 0 if data was stored
 //Return 1 if there was no more space
-uint8_t pairing_assembleMessage(const uint8_t* data, uint32_t len, uint32_t num){
+//Return 2 if there are no free sessions
+//Return 3 if the block does not belong to a session, or is out of order
+uint8_t pairing_assembleMessage(const uint8_t* data, uint32_t len, uint32_t num,
+		const uip_ip6addr_t* addr, const uint8_t* token, uint8_t tokenlen){
+
+	joinsession_t* js = sessionFind(addr, token, tokenlen);
 
 	if(num == 0) {
-		bufsize = 0;	//Clear the buffer
-		memset(buffer, 0, BUFFERSIZE);
+		if(js == NULL){
+			js = sessionAlloc();
+			if(js == NULL) return 2;
+			memcpy(&js->addr, addr, 16);
+			memcpy(js->token, token, tokenlen);
+			js->tokenlen = tokenlen;
+		}
+		js->size = 0;	//Clear the buffer
+		js->nextnum = 0;
+	}
+	if(js == NULL || js->nextnum != num) return 3;
+
+	if(js->size + len > BUFFERSIZE){
+		sessionFree(js);
+		return 1;
 	}
-	if(bufsize + len > BUFFERSIZE) return 1;
-	//For now only one can pair at a time. There is a single buffer.
-	memcpy(buffer + bufsize, data, len);
-	bufsize += len;
+	memcpy(js->buffer + js->size, data, len);
+	js->size += len;
+	js->nextnum++;
+	js->lastactive = clock_time();
 	return 0;
 }
 
-//Returns the data left to send
-//Return 0 if there are no more data to send
-//Return -1 if no file found
-int16_t pairing_getlist(susensors_sensor_t* s, uint8_t* buffer, uint16_t len, int32_t *offset){
-	uint16_t ret = 0;
+/*
+ * The pairs of a device are stored in a journal file, which is only
+ * appended to. The records are:
+ * 	bin:	A pair message, as received in the join. The last 2 bytes are the id
+ * 	u8:		Tombstone, the pair with this id has been removed
+ * 	u16:	Header of a compacted file, with the generation of the file
+ * 	nil:	The compaction of the file was completed
+ *
+ * When enough records are dead, the live pairs are copied to the
+ * other of the 2 files by pairs_compact_process, and the old one is
+ * removed. If both files exists at boot, the compaction was not
+ * finished, and the newest complete file is used.
+ *
+ * An id is only used by one pair record in a file, so a record is live
+ * if a pair has its id. The ids of the records in the active file, live
+ * or not, are kept in a bitmap, and are free again after the compaction.
+ *
+ * A failed append can leave a part of a record at the end of the file,
+ * and the records after it would not be read at boot. Coffee can not
+ * truncate a file, so the journal is marked damaged, nothing more is
+ * appended, and the compaction copies the live pairs before the broken
+ * record to the other file.
+ * */
+#ifdef PAIRINGS_CONF_COMPACT_DEAD
+#define COMPACT_DEAD	PAIRINGS_CONF_COMPACT_DEAD
+#else
+#define COMPACT_DEAD	10		//Dead records before the file is compacted
+#endif
 
-	char filename[30];
+#define JOURNAL_IDS		32		//Bytes in a bitmap of the pair ids 1-255
+#define idIsSet(map, id)	((map)[(id) >> 3] & (1 << ((id) & 7)))
+#define idSet(map, id)		((map)[(id) >> 3] |= 1 << ((id) & 7))
+#define idClear(map, id)	((map)[(id) >> 3] &= ~(1 << ((id) & 7)))
+
+enum record_type{
+	record_end,
+	record_pair,
+	record_tombstone,
+	record_header,
+	record_commit,
+};
+
+struct record_s{
+	uint8_t type;
+	uint8_t id;		//Pair id, or the generation for a header
+	int start;		//Offset of the record in the file
+	int end;
+};
+
+struct journal_s{
+	susensors_sensor_t* device;
+	uint8_t file;		//The active file, 0 or 1
+	uint8_t generation;
+	uint8_t dead;		//Removed pairs and tombstones in the active file
+	uint8_t restart;	//The file was changed while being compacted
+	uint8_t version;	//Changed on every write, so that a listing in progress can tell
+	uint8_t damaged;	//An append failed, the file is only valid up to validend
+	int validend;
+	uint8_t ids[JOURNAL_IDS];	//Ids of the pair records in the active file
+};
+static struct journal_s journals[DEVICES_MAX];
+
+PROCESS(pairs_compact_process, "Pairs compaction");
+
+static void journalFilename(char* filename, susensors_sensor_t* s, uint8_t file){
 	memset(filename, 0, 30);
-	sprintf(filename, "pairs_%s", s->type);
+	sprintf(filename, file == 0 ? "pairs_%s" : "pairB_%s", s->type);
+}
 
-	int fd = cfs_open(filename, CFS_READ);
+static struct journal_s* journalGet(susensors_sensor_t* s){
+	struct journal_s* unused = NULL;
+	for(int i=0; i<DEVICES_MAX; i++){
+		if(journals[i].device == s) return &journals[i];
+		if(journals[i].device == NULL && unused == NULL) unused = &journals[i];
+	}
+	if(unused != NULL){
+		memset(unused, 0, sizeof(struct journal_s));
+		unused->device = s;
+	}
+	return unused;
+}
 
-	if(fd < 0) return -1;
+/*
+ * Read the next record of a journal. If data is given, the pair message
+ * is copied to it (size is the max length, and is set to the length
+ * read), else it is skipped.
+ * Returns the type of the record, record_end at the end or on error
+ * */
+static uint8_t journalNext(cmp_ctx_t* cmp, struct record_s* r, uint8_t* data, uint32_t* size){
+	struct file_s* file = (struct file_s*)cmp->buf;
+	cmp_object_t obj;
+	uint8_t tmp[8];
+
+	r->start = file->offset;
+	r->type = record_end;
+	if(!cmp_read_object(cmp, &obj)) return record_end;
+
+	switch(obj.type){
+	case CMP_TYPE_BIN8:
+	case CMP_TYPE_BIN16:
+	case CMP_TYPE_BIN32:
+		if(obj.as.bin_size < 2) return record_end;
+		if(data != NULL){
+			if(obj.as.bin_size > *size) return record_end;
+			if(!file_reader(cmp, data, obj.as.bin_size)) return record_end;
+			*size = obj.as.bin_size;
+			r->id = data[obj.as.bin_size-1];
+		}
+		else{
+			for(uint32_t left = obj.as.bin_size; left > 0; ){
+				uint32_t n = left > sizeof(tmp) ? sizeof(tmp) : left;
+				if(!file_reader(cmp, tmp, n)) return record_end;
+				left -= n;
+				if(left == 0) r->id = tmp[n-1];
+			}
+		}
+		r->type = record_pair;
+		break;
+	case CMP_TYPE_UINT8:
+		r->id = obj.as.u8;
+		r->type = record_tombstone;
+		break;
+	case CMP_TYPE_UINT16:
+		r->id = obj.as.u16;
+		r->type = record_header;
+		break;
+	case CMP_TYPE_NIL:
+		r->type = record_commit;
+		break;
+	default:
+		return record_end;
+	}
 
-	cfs_seek(fd, *offset, CFS_SEEK_SET);
-	ret = cfs_read(fd, buffer, len);
-	*offset += ret;
+	r->end = file->offset;
+	return r->type;
+}
 
-	cfs_close(fd);
+static joinpair_t* pairFindId(susensors_sensor_t* s, uint8_t id){
+	for(joinpair_t* p = list_head(s->pairs); p; p = list_item_next(p)){
+		if(p->id == id) return p;
+	}
+	return NULL;
+}
 
-	return ret;
+static void pairFree(susensors_sensor_t* s, joinpair_t* p){
+	list_remove(s->pairs, p);
+	peerRemovePair(p);
+	urlRelease(p->dsturl);
+	memb_free(&pairings, p);
 }
-uint8_t pairing_remove_all(susensors_sensor_t* s){
-	char filename[30];
-	memset(filename, 0, 30);
-	sprintf(filename, "pairs_%s", s->type);
 
-	while(list_head(s->pairs) != 0){
-		joinpair_t* p = list_pop(s->pairs);
-		pair_rem_notify(p);
-		free(p->dsturlAbove);
-		free(p->dsturlBelow);
-		free(p->dsturlChange);
-		mmem_free(&p->dsturl);
+/* Set the ids of the live pairs of s in the bitmap live */
+static void pairIds(susensors_sensor_t* s, uint8_t* live){
+	memset(live, 0, JOURNAL_IDS);
+	for(joinpair_t* p = list_head(s->pairs); p; p = list_item_next(p)){
+		idSet(live, p->id);
 	}
+}
 
-	return cfs_remove(filename);
+/* Take an id, that no record in the active file has. Returns 0 if there are none */
+static uint8_t journalNewId(struct journal_s* j){
+	for(int id=1; id<256; id++){
+		if(!idIsSet(j->ids, id)){
+			idSet(j->ids, id);
+			return id;
+		}
+	}
+	return 0;
 }
 
-//Used to read from msgpacked buffer
-static bool buf_reader(cmp_ctx_t *ctx, void *data, uint32_t limit) {
-	for(uint32_t i=0; i<limit; i++){
-		*((char*)data++) = *((char*)ctx->buf++);
+static void journalCompact(){
+	if(!process_is_running(&pairs_compact_process)){
+		process_start(&pairs_compact_process, NULL);
 	}
-	return true;
+	process_poll(&pairs_compact_process);
 }
 
-//Return not needed pairing - Indexes ex. [0,3,4]
-//Return 0 on success
-//Return 1 if there are no pairingfile
-//Return 2 Its not possible to create a temperary file
-//Return 3 There pairings file is empty.
-//Return 4 index array malformed
-//Return 5 Flash is dirty
-//Return 6 no valid ids send
-uint8_t pairing_remove(susensors_sensor_t* s, uint32_t len, uint8_t* indexbuffer){
+/* The active file is only valid up to end, have it rewritten */
+static void journalDamaged(struct journal_s* j, int end){
+	PRINTF("Pairs of %s are damaged from %d\n", j->device->type, end);
+	j->damaged = 1;
+	j->validend = end;
+	journalCompact();
+}
 
-	uint32_t indexlen = 0;	//Received length of indexs
-	struct file_s orig, temp;
+/*
+ * Check if a journal file is complete. A compacted file is only
+ * complete if the compaction got to the end.
+ * Returns the generation of the file, or -1 if it is not usable
+ * */
+static int journalCheck(const char* filename){
+	struct file_s read;
+	struct record_s r;
+	cmp_ctx_t cmp;
+	int generation = 0;
+	int complete = 1;
+
+	file_open(&read, filename, CFS_READ);
+	if(read.fd < 0) return -1;
+
+	cmp_init(&cmp, &read, file_reader, 0);
+	while(journalNext(&cmp, &r, NULL, NULL) != record_end){
+		if(r.type == record_header){
+			generation = r.id;
+			complete = 0;
+		}
+		else if(r.type == record_commit){
+			complete = 1;
+		}
+	}
+	file_close(&read);
+
+	return complete ? generation : -1;
+}
+
+/* Find the active file of a journal, after boot */
+static void journalSelect(struct journal_s* j){
 	char filename[30];
-	uint8_t arr[20];
-	int found = 0;
+	int gen[2];
 
-	cmp_ctx_t cmpindex;
-	cmp_init(&cmpindex, indexbuffer, buf_reader, 0);
+	for(int i=0; i<2; i++){
+		journalFilename(filename, j->device, i);
+		gen[i] = journalCheck(filename);
+	}
 
-	if(!cmp_read_array(&cmpindex, &indexlen)) {
-		return 4;
+	if(gen[0] >= 0 && gen[1] >= 0){
+		//Generations wraps at 256, the newest is the one just after the other
+		j->file = (uint8_t)(gen[0] + 1) == gen[1] ? 1 : 0;
 	}
+	else{
+		j->file = gen[1] >= 0 ? 1 : 0;
+	}
+	j->generation = gen[j->file] >= 0 ? gen[j->file] : 0;
 
-	if(indexlen <= 0) return 6;
+	//Remove the unused file, if any
+	journalFilename(filename, j->device, j->file ^ 1);
+	cfs_remove(filename);
+}
 
-	for(int i=0; i<indexlen; i++){
-		if(!cmp_read_u8(&cmpindex, &arr[i])){
-			return 4;
-		}
+/* Append a record to the active journal file. Returns 0 on success */
+static int journalAppend(struct journal_s* j, const uint8_t* data, uint32_t len, int tombstone){
+	char filename[30];
+	struct file_s write;
+	cmp_ctx_t cmp;
+	int ok;
+	int end;
+
+	if(j->damaged){
+		journalCompact();	//Try again to repair it
+		return -1;
 	}
 
-	//Find out if any of the ids are valid (If only one is, we go forth)
-	for(int i=0; i<indexlen; i++){
-		for(joinpair_t* p = list_head(s->pairs); p; p = list_item_next(p)){
-			if(p->id == arr[i]){
-				found = 1;
-				break;
-			}
-		}
-		if(found) break;
+	journalFilename(filename, j->device, j->file);
+	file_open(&write, filename, CFS_READ | CFS_WRITE | CFS_APPEND);
+	if(write.fd < 0) {
+		return -1;
+	}
+	end = cfs_seek(write.fd, 0, CFS_SEEK_END);
+	if(end < 0){
+		file_close(&write);
+		return -1;
 	}
-	if(found == 0) return 6;
 
-	//Finally create a new file with the pairings
-	memset(filename, 0, 30);
-	sprintf(filename, "pairs_%s", s->type);
+	cmp_init(&cmp, &write, 0, file_writer);
+	if(tombstone){
+		ok = cmp_write_u8(&cmp, data[0]);
+	}
+	else{
+		ok = cmp_write_bin(&cmp, data, len);
+	}
+	ok &= file_flush(&write) == 0;
+	file_close(&write);
 
-	orig.fd = cfs_open(filename, CFS_READ);
-	orig.offset = 0;
-	if(orig.fd < 0){
-		return 1;
+	j->restart = 1;		//A compaction in progress does not have this record
+	j->version++;
+	if(!ok){
+		journalDamaged(j, end);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Append the pairs of a batch join to the journal, in one write.
+ * The messages are read from the batch, and the ids are appended.
+ * Returns 0 on success
+ * */
+static int journalAppendBatch(struct journal_s* j, uint8_t* batch, uint32_t size, const uint8_t* ids, uint32_t count){
+	char filename[30];
+	struct file_s write;
+	struct mem_s mem;
+	cmp_ctx_t cmp;
+	cmp_ctx_t cmpbatch;
+	uint32_t len;
+	int ok = 1;
+	int end;
+
+	if(j->damaged){
+		journalCompact();
+		return -1;
+	}
+
+	journalFilename(filename, j->device, j->file);
+	file_open(&write, filename, CFS_READ | CFS_WRITE | CFS_APPEND);
+	if(write.fd < 0) {
+		return -1;
+	}
+	end = cfs_seek(write.fd, 0, CFS_SEEK_END);
+	if(end < 0){
+		file_close(&write);
+		return -1;
 	}
 
-	temp.fd = cfs_open("temp", CFS_READ | CFS_WRITE);
-	temp.offset = 0;
-	if(temp.fd < 0) {
-		cfs_close(orig.fd);
-		return 2;
+	cmp_init(&cmp, &write, 0, file_writer);
+	mem_open(&mem, batch, size);
+	cmp_init(&cmpbatch, &mem, mem_reader, 0);
+	ok = cmp_read_array(&cmpbatch, &len);
+	for(uint32_t i=0; ok && i<count; i++){
+		ok = cmp_read_bin_size(&cmpbatch, &len) && len <= (uint32_t)(mem.end - mem.ptr);
+		ok = ok && cmp_write_bin_marker(&cmp, len + 2);
+		ok = ok && file_writer(&cmp, mem.ptr, len) == len;
+		ok = ok && cmp_write_u8(&cmp, ids[i]);
+		mem.ptr += ok ? len : 0;
 	}
+	ok = ok && file_flush(&write) == 0;
+	file_close(&write);
 
+	j->restart = 1;		//A compaction in progress does not have these records
+	j->version++;
+	if(!ok){
+		journalDamaged(j, end);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The pair listing is sent blockwise. The place in the journal where
+ * a block ended is kept in a cursor for each client, so that the next
+ * block goes on from there, instead of reading the file from the start.
+ * The file is kept open between the blocks, and is closed when the
+ * listing is done, or when it has been idle for LIST_CURSOR_TIMEOUT.
+ * */
+#ifdef PAIRINGS_CONF_LIST_CURSORS
+#define LIST_CURSORS	PAIRINGS_CONF_LIST_CURSORS
+#else
+#define LIST_CURSORS	1
+#endif
+#define LIST_CURSOR_TIMEOUT	(10 * CLOCK_SECOND)
+
+struct listcursor_s{
+	susensors_sensor_t* device;	//NULL if the cursor is free
+	uip_ip6addr_t addr;
+	uint8_t tokenlen;
+	uint8_t token[COAP_TOKEN_LEN];
+	uint8_t version;		//Of the journal, when the file was opened
+	int32_t offset;			//Offset in the listing, where the next block starts
+	int32_t pos;			//Offset in the listing, of the record at filepos
+	int filepos;			//Record in the journal, where the next block starts
+	clock_time_t lastactive;
+	struct file_s file;
+};
+
+static struct listcursor_s cursors[LIST_CURSORS];
+static struct ctimer cursortimer;
+
+static void cursorFree(struct listcursor_s* c){
+	if(c->device == NULL) return;
+	file_close(&c->file);
+	c->device = NULL;
+}
+
+static void cursorTimeout(void* ptr){
+	int active = 0;
+	for(int i=0; i<LIST_CURSORS; i++){
+		struct listcursor_s* c = &cursors[i];
+		if(c->device == NULL) continue;
+		if((clock_time_t)(clock_time() - c->lastactive) >= LIST_CURSOR_TIMEOUT){
+			PRINTF("Pair listing of %s timed out\n", c->device->type);
+			cursorFree(c);
+		}
+		else{
+			active = 1;
+		}
+	}
+	if(active){
+		ctimer_set(&cursortimer, LIST_CURSOR_TIMEOUT, cursorTimeout, NULL);
+	}
+}
+
+/* Get the cursor of the client, or a new one. If there is no free
+ * cursor, the one idle for the longest time is taken over */
+static struct listcursor_s* cursorGet(susensors_sensor_t* s, const uip_ip6addr_t* addr,
+		const uint8_t* token, uint8_t tokenlen){
+	struct listcursor_s* c = NULL;
+
+	for(int i=0; i<LIST_CURSORS; i++){
+		struct listcursor_s* t = &cursors[i];
+		if(t->device == s && t->tokenlen == tokenlen
+				&& memcmp(&t->addr, addr, 16) == 0
+				&& memcmp(t->token, token, tokenlen) == 0){
+			return t;
+		}
+		if(c == NULL || t->device == NULL ||
+				(c->device != NULL && (clock_time_t)(clock_time() - t->lastactive) > (clock_time_t)(clock_time() - c->lastactive))){
+			c = t;
+		}
+	}
+
+	cursorFree(c);
+	c->device = s;
+	memcpy(&c->addr, addr, 16);
+	memcpy(c->token, token, tokenlen);
+	c->tokenlen = tokenlen;
+	c->offset = -1;
+	c->file.fd = -1;
+	return c;
+}
+
+//Returns the data left to send
+//Return 0 if there are no more data to send
+//Return -1 if no file found
+int16_t pairing_getlist(susensors_sensor_t* s, uint8_t* buffer, uint16_t len, int32_t *offset,
+		const uip_ip6addr_t* addr, const uint8_t* token, uint8_t tokenlen){
+	struct journal_s* j = journalGet(s);
+	struct listcursor_s* c;
+	struct record_s r;
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, &orig, file_reader, file_writer);
-
-	cmp_ctx_t cmptmp;
-	cmp_init(&cmptmp, &temp, file_reader, file_writer);
-
-	/* Copy all the wanted pairings to a temp file */
-	bufsize = BUFFERSIZE;
-	while(cmp_read_bin(&cmp, buffer, &bufsize)){
-		uint8_t id;
-		found = 0;
-		//Its always the last 2 bytes that contains the id
-		cmp_init(&cmpindex, buffer+bufsize-2, buf_reader, 0);
-		if(!cmp_read_u8(&cmpindex, &id)){
-			cfs_close(temp.fd);
-			cfs_close(orig.fd);
-			return 5;
+	char filename[30];
+	int32_t pos = 0;	//Position in the list of live records
+	uint16_t ret = 0;
+	int full = 0;
+	uint8_t live[JOURNAL_IDS];
+
+	if(j == NULL) return -1;
+	c = cursorGet(s, addr, token, tokenlen);
+	pairIds(s, live);
+
+	if(c->file.fd >= 0 && c->version == j->version && c->offset == *offset
+			&& file_seek(&c->file, c->filepos) == 0){
+		//Go on from where the last block ended
+		pos = c->pos;
+	}
+	else{
+		file_close(&c->file);
+		journalFilename(filename, s, j->file);
+		if(file_open(&c->file, filename, CFS_READ) < 0){
+			cursorFree(c);
+			return -1;
 		}
+		c->version = j->version;
+	}
 
-		for(int i=0; i<indexlen; i++){
-			if(arr[i] == id){
-				found = 1;
+	//Only the live pairs are listed, copy the part of them that is requested
+	cmp_init(&cmp, &c->file, file_reader, 0);
+	while(ret < len && journalNext(&cmp, &r, NULL, NULL) != record_end){
+		if(r.type != record_pair || !idIsSet(live, r.id)) continue;
+
+		int32_t size = r.end - r.start;
+		if(pos + size > *offset){
+			int32_t skip = *offset - pos;
+			int32_t n = size - skip;
+			if(n > len - ret) n = len - ret;
+
+			//Read the record again, which leaves the file just after it when all of it is copied
+			if(file_seek(&c->file, r.start + skip) != 0) break;
+			if(!file_reader(&cmp, buffer + ret, n)) break;
+			ret += n;
+			*offset += n;
+
+			if(skip + n < size){
+				//The next block starts inside this record
+				c->filepos = r.start;
+				c->pos = pos;
+				full = 1;
 				break;
 			}
 		}
+		pos += size;
+	}
 
-		if(!found){
-			cmp_write_bin(&cmptmp, buffer, bufsize);
+	if(ret < len){
+		//All of the listing has been sent
+		cursorFree(c);
+	}
+	else{
+		if(!full){
+			c->filepos = c->file.offset;
+			c->pos = pos;
 		}
+		c->offset = *offset;
+		c->lastactive = clock_time();
+		ctimer_set(&cursortimer, LIST_CURSOR_TIMEOUT, cursorTimeout, NULL);
 	}
 
-	cfs_close(orig.fd);
+	return ret;
+}
 
-	if(orig.offset == 0){	//File was empty, just leave
-		cfs_close(temp.fd);
-		return 3;
+/* Encode the pair as a listing record, returns the length */
+static uint32_t pairEncode(joinpair_t* p, uint8_t* buffer, uint32_t size){
+	struct mem_s mem;
+	cmp_ctx_t cmp;
+	int suffix = p->localhost ? 1 : 4;
+
+	mem_open(&mem, buffer, size);
+	cmp_init(&cmp, &mem, 0, mem_writer);
+	cmp_write_u8(&cmp, p->id);
+	cmp_write_array(&cmp, suffix);
+	for(int i=8-suffix; i<8; i++){
+		cmp_write_u16(&cmp, p->destip.u16[i]);
+	}
+	cmp_write_str(&cmp, p->dsturl, strlen(p->dsturl));
+	cmp_write_array(&cmp, 3);
+	for(int i=0; i<3; i++){
+		cmp_write_s8(&cmp, p->triggers[i]);
 	}
+	return mem_used(&mem, buffer);
+}
 
-	cfs_remove(filename);
-	orig.fd = cfs_open(filename, CFS_WRITE);	//Truncate the file to the new content
-	orig.offset = 0;
-	if(orig.fd < 0) {
-		cfs_close(temp.fd);
-		return 1;
+/*
+ * Same as pairing_getlist, but the pairs are listed from memory,
+ * without reading the journal. Each pair is:
+ * 	id (u8), address suffix (u16 array), url (str), triggers (s8 array)
+ * */
+int16_t pairing_getlist_decoded(susensors_sensor_t* s, uint8_t* buffer, uint16_t len, int32_t *offset){
+	uint8_t record[URL_MAXLEN + 24];
+	int32_t pos = 0;
+	uint16_t ret = 0;
+
+	for(joinpair_t* p = list_head(s->pairs); p && ret < len; p = list_item_next(p)){
+		int32_t size = pairEncode(p, record, sizeof(record));
+		if(pos + size > *offset){
+			int32_t skip = *offset - pos;
+			int32_t n = size - skip;
+			if(n > len - ret) n = len - ret;
+
+			memcpy(buffer + ret, record + skip, n);
+			ret += n;
+			*offset += n;
+		}
+		pos += size;
 	}
 
-	//Start writing from the end
-	//cfs_seek(temp.fd, 0, CFS_SEEK_SET);
-	cmp_init(&cmp, &orig, file_reader, file_writer);
+	return ret;
+}
+
+uint8_t pairing_remove_all(susensors_sensor_t* s){
+	char filename[30];
+	struct journal_s* j = journalGet(s);
+
+	while(list_head(s->pairs) != 0){
+		joinpair_t* p = list_head(s->pairs);
+		pair_rem_notify(p);
+		pairFree(s, p);
+	}
 
-	//Next copy the temp data back to the original file
-	while(cmp_read_bin(&cmptmp, buffer, &bufsize)){
-		cmp_write_bin(&cmp, buffer, bufsize);
-		bufsize = BUFFERSIZE;
+	if(j != NULL){
+		j->dead = 0;
+		j->damaged = 0;
+		j->restart = 1;
+		j->version++;
+		memset(j->ids, 0, sizeof(j->ids));
+		journalFilename(filename, s, j->file ^ 1);
+		cfs_remove(filename);
 	}
+	journalFilename(filename, s, j != NULL ? j->file : 0);
+	return cfs_remove(filename);
+}
+
+
+//Return not needed pairing - Indexes ex. [0,3,4]
+//Return 0 on success
+//Return 1 if there are no pairingfile
+//Return 4 index array malformed
+//Return 6 no valid ids send
+uint8_t pairing_remove(susensors_sensor_t* s, uint32_t len, uint8_t* indexbuffer){
+
+	uint32_t indexlen = 0;	//Received length of indexs
+	uint8_t arr[20];
+	struct journal_s* j = journalGet(s);
+	int found = 0;
 
-	bufsize = 0;
+	struct mem_s mem;
+	cmp_ctx_t cmpindex;
+	mem_open(&mem, indexbuffer, len);
+	cmp_init(&cmpindex, &mem, mem_reader, 0);
+
+	if(!cmp_read_array(&cmpindex, &indexlen)) {
+		return 4;
+	}
 
-	cfs_close(orig.fd);
-	cfs_close(temp.fd);
-	cfs_remove("temp");
+	if(indexlen <= 0) return 6;
+	if(indexlen > sizeof(arr)) return 4;
 
-	//Finally remove from memory
 	for(int i=0; i<indexlen; i++){
-		for(joinpair_t* p = list_head(s->pairs); p; p = list_item_next(p)){
-			if(p->id == arr[i]){
-				pair_rem_notify(p);
-				free(p->dsturlAbove);
-				free(p->dsturlBelow);
-				free(p->dsturlChange);
-				mmem_free(&p->dsturl);
-				list_remove(s->pairs, p);
-				break;
-			}
+		if(!cmp_read_u8(&cmpindex, &arr[i])){
+			return 4;
+		}
+	}
+
+	if(j == NULL) return 1;
+
+	//Write a tombstone for each of the pairs, and remove them from memory
+	for(int i=0; i<indexlen; i++){
+		joinpair_t* p = pairFindId(s, arr[i]);
+		if(p == NULL) continue;
+
+		if(journalAppend(j, &arr[i], 1, 1) != 0){
+			return 1;
 		}
+		pair_rem_notify(p);
+		pairFree(s, p);
+		j->dead += 2;	//The pair and its tombstone
+		found = 1;
+	}
+	if(found == 0) return 6;
+
+	if(j->dead >= COMPACT_DEAD){
+		journalCompact();
 	}
 
 	return 0;
@@ -320,11 +834,10 @@ uint8_t pairing_remove(susensors_sensor_t* s, uint32_t len, uint8_t* indexbuffer
 // -6 = Unable to get the prefix, so not possible to pair
 // -7 = Unable to parse the id
 
-int8_t parseMessage(joinpair_t* pair){
+int8_t parseMessage(joinpair_t* pair, uint8_t* payload, uint32_t size){
 
 	uint32_t stringlen;
 	char stringbuf[100];
-	uint8_t* payload = &buffer[0];
 	uint32_t bufindex = 0;
 
 	memset(stringbuf, 0, 100);
@@ -337,14 +850,14 @@ int8_t parseMessage(joinpair_t* pair){
 	 * 	If the array was 16 bytes its an entire ip address, otherwise its suffix
 	 * 	only
 	 * */
-	stringlen = cp_decodeU16Array((uint8_t*) payload + bufindex, (uint16_t*)&pair->destip, &bufindex);
-	stringlen *= 2;	//We work as 8bit
-	pair->localhost = 0;
-
-	if(stringlen < 0){
+	int values = cp_decodeU16Array((uint8_t*) payload + bufindex, size - bufindex, (uint16_t*)&pair->destip, 8, &bufindex);
+	if(values < 0){
 		return -1;
 	}
-	else if(stringlen == 2){	//Could be localhost
+	stringlen = values * 2;	//We work as 8bit
+	pair->localhost = 0;
+
+	if(stringlen == 2){	//Could be localhost
 		memcpy(&pair->destip.u8[16-stringlen], &pair->destip.u8[0], stringlen);
 		memset(&pair->destip, 0, 14);
 		pair->localhost = 1;
@@ -358,72 +871,50 @@ int8_t parseMessage(joinpair_t* pair){
 
 	//Decode the URL of the device
 	stringlen = 100;
-	if(cp_decode_string((uint8_t*) payload + bufindex, &stringbuf[0], &stringlen, &bufindex) != 0){
+	if(cp_decode_string((uint8_t*) payload + bufindex, size - bufindex, &stringbuf[0], &stringlen, &bufindex) != 0){
 		return -2;
 	}
 
-	if(mmem_alloc(&pair->dsturl, stringlen+1) == 0){
+	pair->dsturl = urlIntern(stringbuf);
+	if(pair->dsturl == NULL){
 		return -5;
 	}
-	memcpy((char*)MMEM_PTR(&pair->dsturl), (char*)stringbuf, stringlen+1);
 
 	//Event triggers
-	if(cp_decodeS8Array((uint8_t*) payload + bufindex, pair->triggers, &bufindex) != 0){
-		mmem_free(&pair->dsturl);
+	if(cp_decodeS8Array((uint8_t*) payload + bufindex, size - bufindex, pair->triggers, sizeof(pair->triggers), &bufindex) != 0){
+		urlRelease(pair->dsturl);
 		return -3;
 	}
 
-	//Generate all the connection handles
-	if(pair->dsturlAbove == 0){
-		pair->dsturlAbove = malloc(stringlen + strlen(strAbove)+1);
-		memcpy(pair->dsturlAbove, &stringbuf, strlen(stringbuf));
-		memcpy(pair->dsturlAbove + strlen(stringbuf), strAbove, strlen(strAbove)+1);
-	}
-	if(pair->dsturlBelow == 0){
-		pair->dsturlBelow = malloc(stringlen + strlen(strBelow)+1);
-		memcpy(pair->dsturlBelow, &stringbuf, strlen(stringbuf));
-		memcpy(pair->dsturlBelow + strlen(stringbuf), strBelow, strlen(strBelow)+1);
-	}
-	if(pair->dsturlChange == 0){
-		pair->dsturlChange = malloc(stringlen + strlen(strChange)+1);
-		memcpy(pair->dsturlChange, &stringbuf, strlen(stringbuf));
-		memcpy(pair->dsturlChange + strlen(stringbuf), strChange, strlen(strChange)+1);
-	}
-
-	if(cp_decodeU8((uint8_t*) payload + bufindex, &pair->id, &bufindex) != 0){
-		free(pair->dsturlAbove);
-		free(pair->dsturlBelow);
-		free(pair->dsturlChange);
-		mmem_free(&pair->dsturl);
+	if(cp_decodeU8((uint8_t*) payload + bufindex, size - bufindex, &pair->id, &bufindex) != 0){
+		urlRelease(pair->dsturl);
 		return 0;
 	}
 
 	pair->localdeviceptr = 0;
 	pair->deviceptr = 0;
 	pair->triggerindex = -1;
+	//The pool is not cleared, the handlers are only set for the triggers in use
+	pair->aboveEventhandler = 0;
+	pair->belowEventhandler = 0;
+	pair->changeEventhandler = 0;
 
 	return pair->id;
 }
 
-//Return 0 if success
-//Return >0 if error:
-// -1 = IP address can not be parsed
-// -2 = dst_uri could not be parsed
-// -3 = Unable to allocate enough dynamic memory
-// -4 = src_uri could not be parsed
-// -5 = device already paired
-// -6 = filesystem error
-int8_t pairing_handle(susensors_sensor_t* s){
+/*
+ * Create a pair from a join message, with the id appended,
+ * and add it to the pairs of the device.
+ * Returns the id, or <= 0 on error as pairing_handle
+ * */
+static int8_t pairCreate(susensors_sensor_t* s, uint8_t* payload, uint32_t size){
 
-	uint8_t* payload = &buffer[0];
 	list_t pairings_list = s->pairs;
+	int id;
 
-	if(2 + bufsize > BUFFERSIZE) return -3;
-	int id = lastid == 255 ? 1 : lastid + 1;
-	cp_encodeU8((uint8_t*) payload + bufsize, id, &bufsize);
-
-	joinpair_t* p = (joinpair_t*)memb_alloc(&pairings);
-	id = parseMessage(p);
+	joinpair_t* p = (joinpair_t*)poolAlloc(&pairings_pool);
+	if(p == NULL) return -3;
+	id = parseMessage(p, payload, size);
 
 	if(id <= 0){
 		memb_free(&pairings, p);
@@ -441,86 +932,348 @@ int8_t pairing_handle(susensors_sensor_t* s){
 	joinpair_t* pair = NULL;
 
 	for(pair = (joinpair_t *)list_head(pairings_list); pair; pair = pair->next) {
-		int test = pair->dsturl.size == p->dsturl.size;
+		//Urls are shared, so the same url is the same pointer
+		int test = pair->dsturl == p->dsturl;
 		test &= (memcmp(pair->destip.u8, p->destip.u8, 16) == 0);
 		if(test){
-			free(p->dsturlAbove);
-			free(p->dsturlBelow);
-			free(p->dsturlChange);
-			mmem_free(&p->dsturl);
+			urlRelease(p->dsturl);
 			memb_free(&pairings, p);
 			return -5;
 		}
 	}
 
+	//The pair must be found by the address of its peer
+	if(peerAddPair(p) != 0){
+		urlRelease(p->dsturl);
+		memb_free(&pairings, p);
+		return -3;
+	}
+
 	//Add pair to the list of pairs
 	list_add(pairings_list, p);
 
-	//Finally store pairing info into flash
-	if(store_SensorPair(s, payload, bufsize) != 0){
-		return -6;
+	PRINTF("Pair dst: %s, triggers: 0x%X\n", p->dsturl, (unsigned int)p->triggers);
+
+	return id;
+}
+
+static int8_t handleJoin(susensors_sensor_t* s, uint8_t* payload, uint32_t* bufsize){
+
+	struct journal_s* j = journalGet(s);
+	if(j == NULL) return -6;
+	if(2 + *bufsize > BUFFERSIZE) return -3;
+
+	uint8_t newid = journalNewId(j);
+	if(newid == 0){
+		journalCompact();	//The ids of the dead records are free after it
+		return -3;
 	}
+	cp_encodeU8((uint8_t*) payload + *bufsize, newid, bufsize);
 
-	PRINTF("Pair dst: %s, triggers: 0x%X\n", (char*)MMEM_PTR(&p->dsturl), (unsigned int)p->triggers);
+	int id = pairCreate(s, payload, *bufsize);
+	if(id <= 0){
+		idClear(j->ids, newid);		//Nothing was written
+		return id;
+	}
 
-	pair_add_notify(p);
+	//Finally store pairing info into flash. If it fails, a part of the
+	//record might be written, so the id is kept until the compaction
+	if(store_SensorPair(s, payload, *bufsize) != 0){
+		pairFree(s, pairFindId(s, id));
+		return -6;
+	}
 
-	lastid = lastid < id ? id : lastid;
+	pair_add_notify(pairFindId(s, id));
 
 	return id;
 }
 
-int store_SensorPair(susensors_sensor_t* s, uint8_t* data, uint32_t len){
-	char filename[30];
-	memset(filename, 0, 30);
-	sprintf(filename, "pairs_%s", s->type);
-	struct file_s write;
-	write.fd = cfs_open(filename, CFS_READ | CFS_WRITE | CFS_APPEND);
-	write.offset = 0;
+/*
+ * A batch join is a msgpack array of join messages, each as bin.
+ * All the pairs are validated before anything is stored, and are
+ * then appended to the journal in one go.
+ * */
+#define BATCH_RECORD_MAX	128	//Largest join message in a batch, including the id
+
+static int8_t handleJoinBatch(susensors_sensor_t* s, uint8_t* payload, uint32_t size, uint8_t* ids, uint8_t maxids){
+
+	struct journal_s* j = journalGet(s);
+	uint8_t record[BATCH_RECORD_MAX];
+	uint32_t count;
+	uint32_t len;
+	uint32_t n;
+	int8_t ret = 0;
+	uint8_t taken = 0;	//Ids taken for the batch
+	struct mem_s mem;
+	cmp_ctx_t cmp;
 
-	if(write.fd < 0) {
-		return -1;
+	if(j == NULL) return -6;
+
+	mem_open(&mem, payload, size);
+	cmp_init(&cmp, &mem, mem_reader, 0);
+	if(!cmp_read_array(&cmp, &count) || count == 0 || count > maxids) return -8;
+
+	for(n=0; n<count; n++){
+		if(!cmp_read_bin_size(&cmp, &len) || len + 2 > BATCH_RECORD_MAX
+				|| !mem_reader(&cmp, record, len)){
+			ret = -8;
+			break;
+		}
+
+		ids[n] = journalNewId(j);
+		if(ids[n] == 0){
+			journalCompact();
+			ret = -3;
+			break;
+		}
+		taken++;
+		cp_encodeU8(record + len, ids[n], &len);
+
+		ret = pairCreate(s, record, len);
+		if(ret <= 0) break;
 	}
 
-	cmp_ctx_t cmp;
-	cmp_init(&cmp, &write, file_reader, file_writer);
+	int written = 0;
+	if(ret > 0 && journalAppendBatch(j, payload, size, ids, count) != 0){
+		ret = -6;
+		written = 1;	//Some of the records might be in the file
+	}
+
+	if(ret <= 0){
+		//Undo the pairs created so far. The ids are only used by them
+		for(uint32_t i=0; i<taken; i++){
+			joinpair_t* p = pairFindId(s, ids[i]);
+			if(p != NULL){
+				pairFree(s, p);
+			}
+			if(!written){
+				idClear(j->ids, ids[i]);
+			}
+		}
+		return ret;
+	}
 
-	cmp_write_bin(&cmp, data, len);
-	cfs_close(write.fd);
+	//Schedule all the connections
+	for(n=0; n<count; n++){
+		pair_add_notify(pairFindId(s, ids[n]));
+	}
 
-	return 0;
+	return count;
+}
+
+//Return 0 if success
+//Return >0 if error:
+// -1 = IP address can not be parsed
+// -2 = dst_uri could not be parsed
+// -3 = Unable to allocate enough dynamic memory
+// -4 = src_uri could not be parsed
+// -5 = device already paired
+// -6 = filesystem error
+// -7 = no session for the join
+int8_t pairing_handle(susensors_sensor_t* s, const uip_ip6addr_t* addr, const uint8_t* token, uint8_t tokenlen){
+
+	joinsession_t* js = sessionFind(addr, token, tokenlen);
+	if(js == NULL) return -7;
+
+	int8_t ret = handleJoin(s, js->buffer, &js->size);
+	sessionFree(js);
+	return ret;
+}
+
+//Return the number of pairs created, their ids are written to ids
+//Return <= 0 if error, same as pairing_handle and:
+// -8 = the batch is malformed, or has more than maxids pairs
+int8_t pairing_handle_batch(susensors_sensor_t* s, const uip_ip6addr_t* addr, const uint8_t* token, uint8_t tokenlen,
+		uint8_t* ids, uint8_t maxids){
+
+	joinsession_t* js = sessionFind(addr, token, tokenlen);
+	if(js == NULL) return -7;
+
+	int8_t ret = handleJoinBatch(s, js->buffer, js->size, ids, maxids);
+	sessionFree(js);
+	return ret;
+}
+
+int store_SensorPair(susensors_sensor_t* s, uint8_t* data, uint32_t len){
+	struct journal_s* j = journalGet(s);
+	if(j == NULL) return -1;
+
+	return journalAppend(j, data, len, 0);
 }
 
 void restore_SensorPairs(susensors_sensor_t* s){
+	struct journal_s* j = journalGet(s);
 	struct file_s read;
+	struct record_s r;
 	list_t pairings_list = s->pairs;
-	char filename[40];
-	memset(filename, 0, 40);
-	sprintf(filename, "pairs_%s", s->type);
+	char filename[30];
+
+	if(j == NULL) return;
+	journalSelect(j);
+	journalFilename(filename, s, j->file);
 
-	read.fd = cfs_open(filename, CFS_READ);
-	read.offset = 0;
+	file_open(&read, filename, CFS_READ);
 
 	if(read.fd < 0) {
 		return;
 	}
 
+	//Nobody is joining yet, so borrow a session buffer
+	joinsession_t* js = sessionAlloc();
+	if(js == NULL){
+		file_close(&read);
+		return;
+	}
+
 	cmp_ctx_t cmp;
-	cmp_init(&cmp, &read, file_reader, file_writer);
-	bufsize = BUFFERSIZE;
-	while(cmp_read_bin(&cmp, buffer, &bufsize)){
-		joinpair_t* pair = (joinpair_t*)memb_alloc(&pairings);
-		if(parseMessage(pair) > 0){
-			PRINTF("SrcUri: %s -> DstUri: %s\n", s->type, (char*)MMEM_PTR(&pair->dsturl));
-			pair->deviceptr = s;
-			list_add(pairings_list, pair);
-			lastid = lastid < pair->id ? pair->id : lastid;
+	uint8_t type;
+	cmp_init(&cmp, &read, file_reader, 0);
+	js->size = BUFFERSIZE;
+	while((type = journalNext(&cmp, &r, js->buffer, &js->size)) != record_end){
+		if(r.type == record_pair){
+			//Removed pairs still counts, so that their ids are not reused before the compaction
+			idSet(j->ids, r.id);
+
+			joinpair_t* pair = (joinpair_t*)poolAlloc(&pairings_pool);
+			if(pair == NULL) break;
+			if(parseMessage(pair, js->buffer, js->size) > 0){
+				if(peerAddPair(pair) != 0){
+					PRINTF("No room for the peer of %s\n", pair->dsturl);
+					urlRelease(pair->dsturl);
+					memb_free(&pairings, pair);
+				}
+				else{
+					PRINTF("SrcUri: %s -> DstUri: %s\n", s->type, pair->dsturl);
+					pair->deviceptr = s;
+					list_add(pairings_list, pair);
+				}
+			}
+			else{
+				memb_free(&pairings, pair);
+			}
+		}
+		else if(r.type == record_tombstone){
+			joinpair_t* pair = pairFindId(s, r.id);
+			if(pair != NULL){
+				pairFree(s, pair);
+			}
+			j->dead += 2;
+		}
+		js->size = BUFFERSIZE;
+	}
+	sessionFree(js);
+
+	//Reading stopped before the end, at a broken record
+	if(type == record_end && cfs_seek(read.fd, 0, CFS_SEEK_END) > r.start){
+		journalDamaged(j, r.start);
+	}
+	file_close(&read);
+
+	if(j->dead >= COMPACT_DEAD){
+		journalCompact();
+	}
+}
+
+/* Copy the bytes from start to end of the file fd, to dst. Returns 0 on success */
+static int journalCopy(int fd, int start, int end, cmp_ctx_t* dst){
+	uint8_t tmp[16];
+
+	cfs_seek(fd, start, CFS_SEEK_SET);
+	while(start < end){
+		int n = end - start > sizeof(tmp) ? sizeof(tmp) : end - start;
+		if(cfs_read(fd, tmp, n) != n) return 1;
+		if(file_writer(dst, tmp, n) != n) return 1;
+		start += n;
+	}
+	return 0;
+}
+
+/*
+ * Copy the live pairs of a journal to the other file, one pair
+ * at a time. If the journal is changed meanwhile, the copy is
+ * thrown away and started over. A damaged journal is copied up
+ * to the last complete record.
+ * */
+PROCESS_THREAD(pairs_compact_process, ev, data)
+{
+	static struct journal_s* j;
+	static struct file_s src, dst;
+	static cmp_ctx_t cmpsrc, cmpdst;
+	static struct record_s r;
+	static char filename[30];
+	static int fd;
+	static int ok;
+	static uint8_t live[JOURNAL_IDS];
+
+	PROCESS_BEGIN();
+
+	while(1){
+		j = NULL;
+		for(int i=0; i<DEVICES_MAX; i++){
+			if(journals[i].device != NULL && (journals[i].dead >= COMPACT_DEAD || journals[i].damaged)){
+				j = &journals[i];
+				break;
+			}
+		}
+		if(j == NULL){
+			PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL);
+			continue;
+		}
+
+		PRINTF("Compacting pairs of %s\n", j->device->type);
+		j->restart = 0;
+		pairIds(j->device, live);
+
+		journalFilename(filename, j->device, j->file ^ 1);
+		cfs_remove(filename);
+		file_open(&dst, filename, CFS_READ | CFS_WRITE);
+		journalFilename(filename, j->device, j->file);
+		file_open(&src, filename, CFS_READ);
+		fd = cfs_open(filename, CFS_READ);
+
+		ok = dst.fd >= 0 && src.fd >= 0 && fd >= 0;
+		if(ok){
+			cmp_init(&cmpsrc, &src, file_reader, 0);
+			cmp_init(&cmpdst, &dst, 0, file_writer);
+			ok = cmp_write_u16(&cmpdst, (uint8_t)(j->generation + 1));
+		}
+
+		while(ok && journalNext(&cmpsrc, &r, NULL, NULL) != record_end){
+			if(j->damaged && r.end > j->validend) break;
+			if(r.type == record_pair && idIsSet(live, r.id)){
+				ok = journalCopy(fd, r.start, r.end, &cmpdst) == 0;
+			}
+			PROCESS_PAUSE();
+			ok = ok && !j->restart;
+		}
+		if(ok){
+			ok = cmp_write_nil(&cmpdst) && file_flush(&dst) == 0 && !j->restart;
+		}
+
+		if(fd >= 0) cfs_close(fd);
+		file_close(&src);
+		file_close(&dst);
+
+		if(ok){
+			//The new file is complete, the old one can go
+			cfs_remove(filename);
+			j->file ^= 1;
+			j->generation++;
+			j->version++;
+			j->dead = 0;
+			j->damaged = 0;
+			memcpy(j->ids, live, sizeof(j->ids));
 		}
 		else{
-			memb_free(&pairings, pair);
+			journalFilename(filename, j->device, j->file ^ 1);
+			cfs_remove(filename);
+			if(!j->restart){
+				//Flash error, wait for more removals or appends before trying again
+				j->dead = 0;
+				PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL);
+			}
 		}
-		bufsize = BUFFERSIZE;
 	}
-	bufsize = 0;
-	cfs_close(read.fd);
+
+	PROCESS_END();
 }
@@ -34,11 +34,16 @@
 #define SENSORSUNLEASHED_PAIRING_H_
 
 #include "contiki.h"
-#include "mmem.h"
 #include "net/ipv6/uiplib.h"
 #include "lib/list.h"
 #include "susensors.h"
 
+#ifdef PAIRINGS_CONF_MAX
+#define PAIRINGS_MAX	PAIRINGS_CONF_MAX
+#else
+#define PAIRINGS_MAX	20
+#endif
+
 //We need to have a way to keep track of which sensor a notification belongs to
 enum datatype_e{
 	uartsensor,
@@ -51,11 +56,7 @@ struct __attribute__ ((__packed__)) joinpair_s{
 	uint8_t priority;	//Highest priority (1) will have messages sent before lower priority ones
 	uint8_t localhost;	//If this pair local only
 
-	char* dsturlAbove;
-	char* dsturlBelow;
-	char* dsturlChange;
-
-	struct mmem dsturl;
+	const char* dsturl;		//Shared url of the destination device, see urltable.h
 
 	int8_t triggers[3];	//Which action is set to be triggered
 	int8_t triggerindex; //Used when we setup the pairs connection initially
@@ -66,6 +67,7 @@ struct __attribute__ ((__packed__)) joinpair_s{
 	void* deviceptr;		//Which device this pair belong to
 	void* localdeviceptr;	//In case its a local pair, this is the device pointer
 	uip_ip6addr_t destip;
+	struct joinpair_s *peernext;	//Next pair with the same destip, see peertable.h
 	char nodediscuri[25];
 };
 
@@ -76,18 +78,23 @@ void pairing_init();
 void pair_register_add_callback(void(*cb)(joinpair_t*));
 void pair_register_rem_callback(void(*cb)(joinpair_t*));
 
-int8_t parseMessage(joinpair_t* pair);
+int8_t parseMessage(joinpair_t* pair, uint8_t* payload, uint32_t size);
 
 list_t pairing_get_pairs(void);
 //joinpair_t* getUartSensorPair(uartsensors_device_t* p);
 //void activateUartSensorPairing(uartsensors_device_t* p);
 void activateSUSensorPairing(susensors_sensor_t* p);
 
-uint8_t pairing_assembleMessage(const uint8_t* data, uint32_t len, uint32_t num);
-int16_t pairing_getlist(susensors_sensor_t* s, uint8_t* buffer, uint16_t len, int32_t *offset);
+uint8_t pairing_assembleMessage(const uint8_t* data, uint32_t len, uint32_t num,
+		const uip_ip6addr_t* addr, const uint8_t* token, uint8_t tokenlen);
+int16_t pairing_getlist(susensors_sensor_t* s, uint8_t* buffer, uint16_t len, int32_t *offset,
+		const uip_ip6addr_t* addr, const uint8_t* token, uint8_t tokenlen);
+int16_t pairing_getlist_decoded(susensors_sensor_t* s, uint8_t* buffer, uint16_t len, int32_t *offset);
 uint8_t pairing_remove_all(susensors_sensor_t* s);
 uint8_t pairing_remove(susensors_sensor_t* s, uint32_t len, uint8_t* indexbuffer);
-int8_t pairing_handle(susensors_sensor_t* s);
+int8_t pairing_handle(susensors_sensor_t* s, const uip_ip6addr_t* addr, const uint8_t* token, uint8_t tokenlen);
+int8_t pairing_handle_batch(susensors_sensor_t* s, const uip_ip6addr_t* addr, const uint8_t* token, uint8_t tokenlen,
+		uint8_t* ids, uint8_t maxids);
 int store_SensorPair(susensors_sensor_t* s, uint8_t* data, uint32_t len);
 void restore_SensorPairs(susensors_sensor_t* s);
 
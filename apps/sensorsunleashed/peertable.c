@@ -0,0 +1,182 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#include <string.h>
+#include "contiki.h"
+#include "peertable.h"
+
+/*
+ * Open addressing with linear probing. A slot holds the index+1
+ * of the peer in peers[], 0 is an empty slot. The table is small
+ * enough, that removal shifts the following entries back instead
+ * of leaving tombstones.
+ * */
+#define PEERTABLE_MASK	(PEERTABLE_SIZE - 1)
+
+static peer_t peers[PEERS_MAX];
+static uint8_t slots[PEERTABLE_SIZE];
+
+/* Only the IID is used, the prefix is mostly the same for all peers */
+static uint8_t peerHash(const uip_ip6addr_t* addr){
+	uint16_t h = addr->u16[4] ^ addr->u16[5] ^ addr->u16[6] ^ addr->u16[7];
+	h = (uint16_t)(h * 0x9E37);
+	return (h >> 8) & PEERTABLE_MASK;
+}
+
+/* Return the slot of addr, or -1 if it is not in the table */
+static int peerSlot(const uip_ip6addr_t* addr){
+	uint8_t i = peerHash(addr);
+
+	for(int n=0; n<PEERTABLE_SIZE; n++){
+		if(slots[i] == 0) return -1;
+		if(memcmp(addr, &peers[slots[i]-1].addr, 16) == 0) return i;
+		i = (i + 1) & PEERTABLE_MASK;
+	}
+	return -1;
+}
+
+static peer_t* peerNew(const uip_ip6addr_t* addr){
+	peer_t* p = NULL;
+	int index;
+
+	for(index=0; index<PEERS_MAX; index++){
+		if(!peers[index].used){
+			p = &peers[index];
+			break;
+		}
+	}
+	if(p == NULL) return NULL;
+
+	uint8_t i = peerHash(addr);
+	while(slots[i] != 0){	//There is always a free slot, as PEERTABLE_SIZE > PEERS_MAX
+		i = (i + 1) & PEERTABLE_MASK;
+	}
+
+	p->used = 1;
+	memcpy(&p->addr, addr, 16);
+	p->rev = NULL;
+	p->pairs = NULL;
+	slots[i] = index + 1;
+
+	return p;
+}
+
+/* Remove the peer, once nothing links to it anymore */
+static void peerRelease(peer_t* p){
+	if(p->rev != NULL || p->pairs != NULL) return;
+
+	int i = peerSlot(&p->addr);
+	p->used = 0;
+	if(i < 0) return;
+	slots[i] = 0;
+
+	//Move the following entries back, if their probe sequence passes the hole
+	int j = i;
+	while(1){
+		j = (j + 1) & PEERTABLE_MASK;
+		if(slots[j] == 0) break;
+
+		int h = peerHash(&peers[slots[j]-1].addr);
+		int move = (j > i) ? (h <= i || h > j) : (h <= i && h > j);
+		if(move){
+			slots[i] = slots[j];
+			slots[j] = 0;
+			i = j;
+		}
+	}
+}
+
+void peerTableInit(){
+	memset(peers, 0, sizeof(peers));
+	memset(slots, 0, sizeof(slots));
+}
+
+peer_t* peerFind(const uip_ip6addr_t* addr){
+	int i = peerSlot(addr);
+	if(i < 0) return NULL;
+	return &peers[slots[i]-1];
+}
+
+/*
+ * Return
+ * 		0: Success
+ * 		1: No more room for peers
+ * */
+int peerAddPair(joinpair_t* pair){
+	peer_t* p = peerFind(&pair->destip);
+	if(p == NULL){
+		p = peerNew(&pair->destip);
+		if(p == NULL) return 1;
+	}
+
+	pair->peernext = p->pairs;
+	p->pairs = pair;
+	return 0;
+}
+
+void peerRemovePair(joinpair_t* pair){
+	peer_t* p = peerFind(&pair->destip);
+	if(p == NULL) return;
+
+	for(joinpair_t** i = &p->pairs; *i; i = &(*i)->peernext){
+		if(*i == pair){
+			*i = pair->peernext;
+			break;
+		}
+	}
+	pair->peernext = NULL;
+	peerRelease(p);
+}
+
+/*
+ * Return
+ * 		0: Success
+ * 		1: No more room for peers
+ * */
+int peerSetRev(revlookup_t* rev){
+	peer_t* p = peerFind(&rev->srcip);
+	if(p == NULL){
+		p = peerNew(&rev->srcip);
+		if(p == NULL) return 1;
+	}
+
+	p->rev = rev;
+	return 0;
+}
+
+void peerClearRev(revlookup_t* rev){
+	peer_t* p = peerFind(&rev->srcip);
+	if(p == NULL || p->rev != rev) return;
+
+	p->rev = NULL;
+	peerRelease(p);
+}
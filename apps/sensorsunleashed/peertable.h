@@ -0,0 +1,81 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#ifndef SENSORSUNLEASHED_PEERTABLE_H_
+#define SENSORSUNLEASHED_PEERTABLE_H_
+
+#include "net/ipv6/uiplib.h"
+#include "pairing.h"
+#include "reverseNotify.h"
+
+/*
+ * Index of the peers we know, by their address.
+ * Each peer links to the pairs that points to it and its
+ * reverse notify entry, so that a peer calling in can be
+ * handled without searching through all devices and pairs.
+ * */
+#ifdef PEERTABLE_CONF_MAX
+#define PEERS_MAX	PEERTABLE_CONF_MAX
+#else
+#define PEERS_MAX	(PAIRINGS_MAX + REVLOOKUP_MAX)
+#endif
+
+/* Number of hash slots, must be a power of 2 and larger than PEERS_MAX */
+#ifdef PEERTABLE_CONF_SIZE
+#define PEERTABLE_SIZE	PEERTABLE_CONF_SIZE
+#else
+#define PEERTABLE_SIZE	64
+#endif
+
+#if PEERTABLE_SIZE <= PEERS_MAX
+#error "PEERTABLE_SIZE must be larger than PEERS_MAX, the probing needs a free slot"
+#endif
+#if PEERTABLE_SIZE > 256 || (PEERTABLE_SIZE & (PEERTABLE_SIZE - 1)) != 0
+#error "PEERTABLE_SIZE must be a power of 2, and max 256"
+#endif
+
+struct peer_s{
+	uint8_t used;
+	uip_ip6addr_t addr;
+	revlookup_t* rev;		//Reverse notify entry, if any
+	joinpair_t* pairs;		//Pairs with this peer as destination, linked by peernext
+};
+typedef struct peer_s peer_t;
+
+void peerTableInit();
+peer_t* peerFind(const uip_ip6addr_t* addr);
+int peerAddPair(joinpair_t* pair);
+void peerRemovePair(joinpair_t* pair);
+int peerSetRev(revlookup_t* rev);
+void peerClearRev(revlookup_t* rev);
+
+#endif /* SENSORSUNLEASHED_PEERTABLE_H_ */
@@ -0,0 +1,141 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#include <string.h>
+#include <stdio.h>
+#include "contiki.h"
+#include "lib/list.h"
+#include "cmp_helpers.h"
+#include "poolstats.h"
+#include "slab.h"
+
+#define DEBUG 0
+#if DEBUG
+#include <stdio.h>
+#define PRINTF(...) printf(__VA_ARGS__)
+#else
+#define PRINTF(...)
+#endif
+
+LIST(pools);
+
+/* A pool is registered when it is first used, or by its module at init,
+ * so that pools which has not been used yet are also listed */
+void poolRegister(struct pool_s* p){
+	if(p->registered) return;
+	p->registered = 1;
+	list_add(pools, p);
+}
+
+void* poolAlloc(struct pool_s* p){
+	poolRegister(p);
+
+	void* ptr = memb_alloc(p->memb);
+	if(ptr == NULL){
+		p->failed++;
+		PRINTF("Pool %s is empty, failed %u\n", p->name, p->failed);
+		return NULL;
+	}
+
+	uint16_t used = p->memb->num - memb_numfree(p->memb);
+	if(used > p->peak) p->peak = used;
+	return ptr;
+}
+
+#define NAME_MAXLEN	24		//Longer names are cut, so that a record fits in 40 bytes
+
+static uint32_t encodeRecord(uint8_t* buffer, uint32_t size, const char* name, uint16_t capacity,
+		uint16_t used, uint16_t peak, uint16_t failed){
+	struct mem_s mem;
+	cmp_ctx_t cmp;
+	uint32_t n = strlen(name);
+	mem_open(&mem, buffer, size);
+	cmp_init(&cmp, &mem, 0, mem_writer);
+
+	cmp_write_array(&cmp, 5);
+	cmp_write_str(&cmp, name, n > NAME_MAXLEN ? NAME_MAXLEN : n);
+	cmp_write_u16(&cmp, capacity);
+	cmp_write_u16(&cmp, used);
+	cmp_write_u16(&cmp, peak);
+	cmp_write_u16(&cmp, failed);
+	return mem_used(&mem, buffer);
+}
+
+/*
+ * Encode the use of all pools, and the slab size classes, as an array
+ * of [name, capacity, used, peak, failed]. Sent blockwise like the pair
+ * listing, returns the length written from offset.
+ * */
+int16_t poolStatsEncode(uint8_t* buffer, uint16_t len, int32_t *offset){
+	uint8_t record[40];
+	char name[10];
+	int32_t pos = 0;
+	uint16_t ret = 0;
+	int count = list_length(pools) + SLAB_CLASSES;
+	struct pool_s* p = list_head(pools);
+
+	for(int i=-1; i<count && ret < len; i++){
+		int32_t size;
+
+		if(i < 0){
+			struct mem_s mem;
+			cmp_ctx_t cmp;
+			mem_open(&mem, record, sizeof(record));
+			cmp_init(&cmp, &mem, 0, mem_writer);
+			cmp_write_array(&cmp, count);
+			size = mem_used(&mem, record);
+		}
+		else if(p != NULL){
+			size = encodeRecord(record, sizeof(record), p->name, p->memb->num,
+					p->memb->num - memb_numfree(p->memb), p->peak, p->failed);
+			p = list_item_next(p);
+		}
+		else{
+			const struct slab_stats_s* st = slab_stats(i - list_length(pools));
+			sprintf(name, "slab%u", st->size);
+			size = encodeRecord(record, sizeof(record), name, st->blocks, st->used, st->peak, st->failed);
+		}
+
+		if(pos + size > *offset){
+			int32_t skip = *offset - pos;
+			int32_t n = size - skip;
+			if(n > len - ret) n = len - ret;
+
+			memcpy(buffer + ret, record + skip, n);
+			ret += n;
+			*offset += n;
+		}
+		pos += size;
+	}
+
+	return ret;
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#ifndef SENSORSUNLEASHED_POOLSTATS_H_
+#define SENSORSUNLEASHED_POOLSTATS_H_
+
+#include "contiki.h"
+#include "lib/memb.h"
+
+/*
+ * Registry of the fixed memory pools, so that their use can be read
+ * from the node. A pool is declared with POOL instead of MEMB, and
+ * allocated with poolAlloc, which keeps track of the peak use and the
+ * failed allocations. Freeing is done with memb_free as usual.
+ * */
+struct pool_s{
+	struct pool_s *next;
+	const char* name;
+	struct memb* memb;
+	uint8_t registered;
+	uint16_t peak;		//Most blocks used at once
+	uint16_t failed;	//Allocations that found the pool empty
+};
+
+#define POOL(name, structure, num) \
+	MEMB(name, structure, num); \
+	static struct pool_s name##_pool = { NULL, #name, &name, 0, 0, 0 }
+
+void poolRegister(struct pool_s* p);
+void* poolAlloc(struct pool_s* p);
+int16_t poolStatsEncode(uint8_t* buffer, uint16_t len, int32_t *offset);
+
+#endif /* SENSORSUNLEASHED_POOLSTATS_H_ */
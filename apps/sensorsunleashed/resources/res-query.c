@@ -0,0 +1,56 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#include <string.h>
+#include "res-query.h"
+
+/*
+ * Find the command of a query. Only the name of the first parameter is
+ * looked up, a value after '=' is read by the handler with
+ * REST.get_query_variable.
+ * Returns the id of the command, or QUERY_UNKNOWN
+ * */
+int queryFind(const struct query_s* table, int count, const char* query, int len){
+	int namelen = 0;
+
+	while(namelen < len && query[namelen] != '=' && query[namelen] != '&'){
+		namelen++;
+	}
+
+	for(int i=0; i<count; i++){
+		if(table[i].len == namelen && table[i].name[0] == query[0]
+				&& memcmp(table[i].name, query, namelen) == 0){
+			return table[i].id;
+		}
+	}
+	return QUERY_UNKNOWN;
+}
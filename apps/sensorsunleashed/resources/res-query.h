@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#ifndef SENSORSUNLEASHED_RESOURCES_RES_QUERY_H_
+#define SENSORSUNLEASHED_RESOURCES_RES_QUERY_H_
+
+#include "contiki.h"
+
+/*
+ * Table of the query commands a resource handles. Each resource keeps
+ * a const table of its commands, which maps the name of the command to
+ * an id the handler dispatches on. The length of the names is found at
+ * compile time, and a query only matches a name of exactly its length,
+ * so "Range" is not taken for "RangeMin".
+ * 	QUERY("MemStats", q_memStats),
+ * */
+struct query_s{
+	const char* name;
+	uint8_t len;
+	uint8_t id;
+};
+
+#define QUERY(name, id)		{ name, sizeof(name) - 1, id }
+#define QUERIES(table)		(sizeof(table) / sizeof(table[0]))
+
+#define QUERY_UNKNOWN	-1
+
+int queryFind(const struct query_s* table, int count, const char* query, int len);
+
+#endif /* SENSORSUNLEASHED_RESOURCES_RES_QUERY_H_ */
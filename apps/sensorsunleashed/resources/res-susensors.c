@@ -39,10 +39,13 @@
 #include "board.h"
 #include "susensors.h"
 #include "pairing.h"
+#include "poolstats.h"
+#include "senml.h"
+#include "res-query.h"
 //#include "../../apps/uartsensors/uart_protocolhandler.h"
 
 #define MAX_RESOURCES	20
-MEMB(coap_resources, resource_t, MAX_RESOURCES);
+POOL(coap_resources, resource_t, MAX_RESOURCES);
 
 #define DEBUG 1
 #if DEBUG
@@ -59,16 +62,143 @@ MEMB(coap_resources, resource_t, MAX_RESOURCES);
 static void res_susensor_gethandler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
 static void res_susensor_puthandler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
 
+enum susensor_query{
+	q_aboveEventAt,
+	q_belowEventAt,
+	q_changeEventAt,
+	q_rangeMin,
+	q_rangeMax,
+	q_getEventState,
+	q_getEventSetup,
+	q_getEventLimits,
+	q_saveSetup,
+	q_pairings,
+	q_pairingsDecoded,
+	q_postEvent,
+	q_setCommand,
+	q_eventsetup,
+	q_eventlimits,
+	q_pairRemoveIndex,
+	q_pairRemoveAll,
+	q_join,
+	q_joinBatch,
+};
+
+static const struct query_s getQueries[] = {
+	QUERY("AboveEventAt", q_aboveEventAt),
+	QUERY("BelowEventAt", q_belowEventAt),
+	QUERY("ChangeEventAt", q_changeEventAt),
+	QUERY("RangeMin", q_rangeMin),
+	QUERY("RangeMax", q_rangeMax),
+	QUERY("getEventState", q_getEventState),
+	QUERY("getEventSetup", q_getEventSetup),
+	QUERY("getEventLimits", q_getEventLimits),
+	QUERY("saveSetup", q_saveSetup),
+	QUERY("pairings", q_pairings),
+	QUERY("pairingsDecoded", q_pairingsDecoded),
+};
+
+static const struct query_s putQueries[] = {
+	QUERY("postEvent", q_postEvent),
+	QUERY("setCommand", q_setCommand),
+	QUERY("eventsetup", q_eventsetup),
+	QUERY("eventlimits", q_eventlimits),
+	QUERY("pairRemoveIndex", q_pairRemoveIndex),
+	QUERY("pairRemoveAll", q_pairRemoveAll),
+	QUERY("join", q_join),
+	QUERY("joinBatch", q_joinBatch),
+};
+
 #define MSG_PACKED	0
 #define PLAIN_TEXT	1
+#define SENML_CBOR	2
+
+/* The format of the response, from the Accept option of the request */
+static int responseFormat(void *request){
+	unsigned int accept = -1;
+	if(REST.get_header_accept(request, &accept)){
+		if(accept == REST.type.TEXT_PLAIN) return PLAIN_TEXT;
+		if(accept == SENML_CBOR_FORMAT) return SENML_CBOR;
+	}
+	return MSG_PACKED;
+}
+
+/*
+ * Responses with more than one value are only sent msgpacked.
+ * Returns 1 if the client asked for something else, and has been answered
+ * */
+static int msgpackOnly(void *response, int format){
+	if(format != MSG_PACKED){
+		REST.set_response_status(response, REST.status.NOT_ACCEPTABLE);
+		const char *error_msg = "msgPacked only";
+		REST.set_response_payload(response, error_msg, strlen(error_msg));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Send a single value. As text it is scaled by the resolution of the
+ * device, so that it can be read without decoding msgpack.
+ * */
+static void sendValue(void *response, uint8_t *buffer, cmp_object_t *obj, int format, uint32_t resolution){
+	uint32_t len = 0;
+
+	if(format == SENML_CBOR){	//Only the device value is sent as SenML
+		REST.set_response_status(response, REST.status.NOT_ACCEPTABLE);
+		return;
+	}
+	else if(format == PLAIN_TEXT){
+		if(cp_cmp_to_string_scaled(obj, resolution, buffer, &len) != 0){
+			REST.set_response_status(response, REST.status.NOT_ACCEPTABLE);
+			return;
+		}
+		REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
+	}
+	else{
+		len = cp_encodeObject(buffer, obj);
+	}
+	REST.set_response_status(response, REST.status.OK);
+	REST.set_response_payload(response, buffer, len);
+}
+
+/*
+ * Send the device value as SenML, together with the unit and the range
+ * of the device, so that a collector does not have to ask for them.
+ * time is seconds relative to now, 0 if the value is current.
+ * */
+static void sendReading(struct susensors_sensor *sensor, void *response, uint8_t *buffer, uint16_t size,
+		const char *url, int urllen, cmp_object_t *value, int32_t time){
+	struct resourceconf* config = (struct resourceconf*)sensor->data.config;
+	struct senml_s s;
+	cmp_object_t min, max;
+
+	int hasrange = sensor->suconfig(sensor, SUSENSORS_RANGEMIN_GET, &min) == 0
+			&& sensor->suconfig(sensor, SUSENSORS_RANGEMAX_GET, &max) == 0;
+
+	senmlOpen(&s, buffer, size, config->resolution, hasrange ? 3 : 1);
+	senmlRecord(&s, url, urllen, NULL, config->unit, time, value);
+	if(hasrange){
+		senmlRecord(&s, NULL, 0, "/RangeMin", config->unit, 0, &min);
+		senmlRecord(&s, NULL, 0, "/RangeMax", config->unit, 0, &max);
+	}
+
+	int32_t len = senmlClose(&s, buffer);
+	if(len < 0){
+		REST.set_response_status(response, REST.status.INTERNAL_SERVER_ERROR);
+		return;
+	}
+	REST.set_header_content_type(response, SENML_CBOR_FORMAT);
+	REST.set_response_status(response, REST.status.OK);
+	REST.set_response_payload(response, buffer, len);
+}
 
 static void
 res_susensor_gethandler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset){
 
 	const char *url = NULL;
 	const char *str = NULL;
-	unsigned int ct = -1;
-	REST.get_header_content_type(request, &ct);
+	int format = responseFormat(request);
 
 	//	if(ct != REST.type.APPLICATION_OCTET_STREAM) {
 	//		REST.set_response_status(response, REST.status.BAD_REQUEST);
@@ -87,44 +217,66 @@ res_susensor_gethandler(void *request, void *response, uint8_t *buffer, uint16_t
 	//		}
 	//	}
 
+	uint8_t sub = noEvent;
 	int len = REST.get_url(request, &url);
-	struct susensors_sensor *sensor = (struct susensors_sensor *)susensors_find(url, len);
+	int urllen = len;
+	struct susensors_sensor *sensor = (struct susensors_sensor *)susensors_find(url, len, &sub);
 	if(sensor != NULL){
 		cmp_object_t obj;
+		uint32_t resolution = ((struct resourceconf*)sensor->data.config)->resolution;
 		len = REST.get_query(request, &str);
 		if(len > 0){
-			if(strncmp(str, "AboveEventAt", len) == 0){
+			int q = queryFind(getQueries, QUERIES(getQueries), str, len);
+			if(q == q_aboveEventAt){
 				len = sensor->suconfig(sensor, SUSENSORS_AEVENT_GET, &obj) == 0;
 				REST.set_header_max_age(response, 3600);
 			}
-			else if(strncmp(str, "BelowEventAt", len) == 0){
+			else if(q == q_belowEventAt){
 				len = sensor->suconfig(sensor, SUSENSORS_BEVENT_GET, &obj) == 0;
 				REST.set_header_max_age(response, 3600);
 			}
-			else if(strncmp(str, "ChangeEventAt", len) == 0){
+			else if(q == q_changeEventAt){
 				len = sensor->suconfig(sensor, SUSENSORS_CEVENT_GET, &obj) == 0;
 				REST.set_header_max_age(response, 3600);
 			}
-			else if(strncmp(str, "RangeMin", len) == 0){
+			else if(q == q_rangeMin){
 				len = sensor->suconfig(sensor, SUSENSORS_RANGEMIN_GET, &obj) == 0;
 			}
-			else if(strncmp(str, "RangeMax", len) == 0){
+			else if(q == q_rangeMax){
 				len = sensor->suconfig(sensor, SUSENSORS_RANGEMAX_GET, &obj) == 0;
 			}
-			else if(strncmp(str, "getEventState", len) == 0){
+			else if(q == q_getEventState){
 				len = sensor->suconfig(sensor, SUSENSORS_EVENTSTATE_GET, &obj) == 0;
+				resolution = 1;		//A mask, not a value
 			}
-			else if(strncmp(str, "getEventSetup", len) == 0){
+			else if(q == q_getEventSetup){
+				if(msgpackOnly(response, format)) return;
 				len = sensor->suconfig(sensor, SUSENSORS_EVENTSETUP_GET, buffer);
 				REST.set_response_payload(response, buffer, len);
 				return;
 			}
-			else if(strncmp(str, "saveSetup", len) == 0){
+			else if(q == q_getEventLimits){
+				if(msgpackOnly(response, format)) return;
+				len = sensor->suconfig(sensor, SUSENSORS_EVENTLIMITS_GET, buffer);
+				REST.set_response_payload(response, buffer, len);
+				return;
+			}
+			else if(q == q_saveSetup){
 				len = sensor->suconfig(sensor, SUSENSORS_STORE_SETUP, &obj) == 0;
 			}
-			else if(strncmp(str, "pairings", len) == 0){
+			else if(q == q_pairings || q == q_pairingsDecoded){
+				coap_packet_t *const coap_req = (coap_packet_t *)request;
+				int16_t ret;
+
+				if(msgpackOnly(response, format)) return;
 
-				int16_t ret = pairing_getlist(sensor, buffer, preferred_size, offset);
+				if(q == q_pairings){
+					ret = pairing_getlist(sensor, buffer, preferred_size, offset,
+							&UIP_IP_BUF->srcipaddr, coap_req->token, coap_req->token_len);
+				}
+				else{
+					ret = pairing_getlist_decoded(sensor, buffer, preferred_size, offset);
+				}
 
 				if( ret == -1){
 					REST.set_response_status(response, REST.status.BAD_REQUEST);
@@ -143,18 +295,138 @@ res_susensor_gethandler(void *request, void *response, uint8_t *buffer, uint16_t
 			}
 		}
 		else{	//Send the actual value
-			len = sensor->status(sensor, ActualValue, &obj) == 0;
+			int32_t time = 0;
+			const uint8_t* snapshot;
+			int snapshotlen = susensors_snapshot(sensor, &snapshot);
 			REST.set_header_max_age(response, 30);
+
+			if(sub == combinedEvent){
+				//Combined events stream: event mask followed by the value
+				const suevent_t* e = susensors_current_event();
+				if(msgpackOnly(response, format)) return;
+				uint32_t bufindex = 0;
+				cp_encodeU8(buffer, snapshotlen > 0 ? e->event : SUSENSORS_NO_EVENT, &bufindex);
+				if(snapshotlen > 0){
+					memcpy(buffer + bufindex, snapshot, snapshotlen);
+					bufindex += snapshotlen;
+				}
+				else if(sensor->status(sensor, ActualValue, &obj) == 0){
+					bufindex += cp_encodeObject(buffer + bufindex, &obj);
+				}
+				REST.set_response_status(response, REST.status.OK);
+				REST.set_response_payload(response, buffer, bufindex);
+				return;
+			}
+
+			if(snapshotlen > 0 && format != MSG_PACKED){
+				const suevent_t* e = susensors_current_event();
+				uint32_t n;
+				len = cp_decodeObject(snapshot, snapshotlen, &obj, &n) == 0;
+				time = -(int32_t)((clock_time() - e->timestamp) / CLOCK_SECOND);
+			}
+			else if(snapshotlen > 0){
+				//We are notifying observers of an event, use the value of the event
+				memcpy(buffer, snapshot, snapshotlen);
+				REST.set_response_status(response, REST.status.OK);
+				REST.set_response_payload(response, buffer, snapshotlen);
+				return;
+			}
+			else{
+				len = sensor->status(sensor, ActualValue, &obj) == 0;
+			}
+
+			if(len && format == SENML_CBOR){
+				sendReading(sensor, response, buffer, preferred_size, url, urllen, &obj, time);
+				return;
+			}
 		}
 
 		if(len){
-			len = cp_encodeObject(buffer, &obj);
-			REST.set_response_status(response, REST.status.OK);
-			REST.set_response_payload(response, buffer, len);
+			sendValue(response, buffer, &obj, format, resolution);
 		}
 	}
 }
 
+/* Set the response for a join that failed, see pairing_handle */
+static void
+joinErrorStatus(void *response, int res){
+	switch(res){
+	case 0:
+		REST.set_response_status(response, REST.status.INTERNAL_SERVER_ERROR);
+		break;
+	case -1:
+		REST.set_response_status(response, REST.status.BAD_REQUEST);
+		const char *error_msg1 = "IPAdress wrong";
+		REST.set_response_payload(response, error_msg1, strlen(error_msg1));
+		break;
+	case -2:
+		REST.set_response_status(response, REST.status.BAD_REQUEST);
+		const char *error_msg2 = "Destination URI wrong";
+		REST.set_response_payload(response, error_msg2, strlen(error_msg2));
+		break;
+	case -3:
+		REST.set_response_status(response, REST.status.INTERNAL_SERVER_ERROR);
+		break;
+	case -4:
+		REST.set_response_status(response, REST.status.BAD_REQUEST);
+		const char *error_msg3 = "Source URI wrong";
+		REST.set_response_payload(response, error_msg3, strlen(error_msg3));
+		break;
+	case -5:
+		REST.set_response_status(response, REST.status.NOT_MODIFIED);
+		break;
+	case -6:
+		REST.set_response_status(response, REST.status.INTERNAL_SERVER_ERROR);
+		break;
+	case -7:
+		REST.set_response_status(response, REST.status.BAD_REQUEST);
+		break;
+	case -8:
+		REST.set_response_status(response, REST.status.BAD_REQUEST);
+		const char *error_msg4 = "Batch malformed";
+		REST.set_response_payload(response, error_msg4, strlen(error_msg4));
+		break;
+	}
+}
+
+/*
+ * Add the Block1 block of a join, or a batch join, to the session of
+ * the client. The response is set for the block.
+ * Returns 1 when the last block has been received, and the join can be
+ * handled, else 0
+ * */
+static int
+joinAssemble(void *request, void *response){
+	coap_packet_t *const coap_req = (coap_packet_t *)request;
+	const uint8_t *payload = NULL;
+
+	int len = REST.get_request_payload(request, &payload);
+	if(len == 0) return 0;
+
+	int ret = pairing_assembleMessage(payload, len, coap_req->block1_num,
+			&UIP_IP_BUF->srcipaddr, coap_req->token, coap_req->token_len);
+	if(ret == 0){
+		REST.set_response_status(response, REST.status.CHANGED);
+		coap_set_header_block1(response, coap_req->block1_num, 0, coap_req->block1_size);
+	}
+	else if(ret == 2){
+		REST.set_response_status(response, REST.status.SERVICE_UNAVAILABLE);
+		return 0;
+	}
+	else if(ret == 3){
+		REST.set_response_status(response, REST.status.BAD_REQUEST);
+		const char *error_msg = "Unknown join session";
+		REST.set_response_payload(response, error_msg, strlen(error_msg));
+		return 0;
+	}
+	else {
+		REST.set_response_status(response, REST.status.REQUEST_ENTITY_TOO_LARGE);
+		return 0;
+	}
+
+	return coap_req->block1_more == 0;
+}
+
 static void
 res_susensor_puthandler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset){
 
@@ -173,14 +445,15 @@ res_susensor_puthandler(void *request, void *response, uint8_t *buffer, uint16_t
 
 	int len = REST.get_url(request, &url);
 	coap_packet_t *const coap_req = (coap_packet_t *)request;
-	struct susensors_sensor *sensor = (struct susensors_sensor *)susensors_find(url, len);
+	struct susensors_sensor *sensor = (struct susensors_sensor *)susensors_find(url, len, NULL);
 	if(sensor != NULL){
 		len = REST.get_query(request, &str);
 		if(len > 0){
 			/* Issue a command. The command is one of the enum suactions values*/
 			const char *commandstr = NULL;
 			char *pEnd;
-			if(strncmp(str, "postEvent", len) == 0){
+			int q = queryFind(putQueries, QUERIES(putQueries), str, len);
+			if(q == q_postEvent){
 				len = REST.get_request_payload(request, &payload);
 				if((len = sensor->eventhandler(sensor, len, (uint8_t*)payload)) == 0){
 					REST.set_response_status(response, REST.status.OK);
@@ -189,7 +462,7 @@ res_susensor_puthandler(void *request, void *response, uint8_t *buffer, uint16_t
 					REST.set_response_status(response, REST.status.BAD_REQUEST);
 				}
 			}
-			else if(REST.get_query_variable(request, "setCommand", &commandstr) > 0 && commandstr != NULL) {
+			else if(q == q_setCommand && REST.get_query_variable(request, "setCommand", &commandstr) > 0 && commandstr != NULL) {
 				if(sensor->value(sensor, strtol(commandstr, &pEnd, 10), 0) == 0){	//For now, no payload - might be necessary in the furture
 					cmp_object_t obj;
 					len = sensor->status(sensor, ActualValue, &obj) == 0;
@@ -201,7 +474,7 @@ res_susensor_puthandler(void *request, void *response, uint8_t *buffer, uint16_t
 					REST.set_response_status(response, REST.status.BAD_REQUEST);
 				}
 			}
-			else if(strncmp(str, "eventsetup", len) == 0){
+			else if(q == q_eventsetup){
 				len = REST.get_request_payload(request, &payload);
 				if(len <= 0){
 					REST.set_response_status(response, REST.status.BAD_REQUEST);
@@ -211,14 +484,32 @@ res_susensor_puthandler(void *request, void *response, uint8_t *buffer, uint16_t
 				}
 
 				//TODO: Generate human readable error messages, if parsing fails (see pairing)
-				if(sensor->suconfig(sensor, SUSENSORS_EVENTSETUP_SET, (void*)payload) == 0){
+				struct supayload_s p = { payload, len };
+				if(sensor->suconfig(sensor, SUSENSORS_EVENTSETUP_SET, &p) == 0){
+					REST.set_response_status(response, REST.status.CHANGED);
+				}
+				else{
+					REST.set_response_status(response, REST.status.BAD_REQUEST);
+				}
+			}
+			else if(q == q_eventlimits){
+				len = REST.get_request_payload(request, &payload);
+				if(len <= 0){
+					REST.set_response_status(response, REST.status.BAD_REQUEST);
+					const char *error_msg = "no payload in query";
+					REST.set_response_payload(response, error_msg, strlen(error_msg));
+					return;
+				}
+
+				struct supayload_s p = { payload, len };
+				if(sensor->suconfig(sensor, SUSENSORS_EVENTLIMITS_SET, &p) == 0){
 					REST.set_response_status(response, REST.status.CHANGED);
 				}
 				else{
 					REST.set_response_status(response, REST.status.BAD_REQUEST);
 				}
 			}
-			else if(strncmp(str, "pairRemoveIndex", len) == 0){
+			else if(q == q_pairRemoveIndex){
 				len = REST.get_request_payload(request, &payload);
 				int ret = pairing_remove(sensor, len, (uint8_t*) payload);
 				if(ret == 0){
@@ -234,7 +525,7 @@ res_susensor_puthandler(void *request, void *response, uint8_t *buffer, uint16_t
 					REST.set_response_status(response, REST.status.BAD_REQUEST);
 				}
 			}
-			else if(strncmp(str, "pairRemoveAll", len) == 0){
+			else if(q == q_pairRemoveAll){
 				if(pairing_remove_all(sensor) == 0){
 					REST.set_response_status(response, REST.status.CHANGED);
 				}
@@ -242,61 +533,39 @@ res_susensor_puthandler(void *request, void *response, uint8_t *buffer, uint16_t
 					REST.set_response_status(response, REST.status.BAD_REQUEST);
 				}
 			}
-			else if(strncmp(str, "join", len) == 0){
-				if((len = REST.get_request_payload(request, (const uint8_t **)&payload))) {
-						if(pairing_assembleMessage(payload, len, coap_req->block1_num) == 0){
-							REST.set_response_status(response, REST.status.CHANGED);
-							coap_set_header_block1(response, coap_req->block1_num, 0, coap_req->block1_size);
-						}
-						else {
-							REST.set_response_status(response, REST.status.REQUEST_ENTITY_TOO_LARGE);
-							return;
-						}
-
-						if(coap_req->block1_more == 0){
-							//We're finished receiving the payload, now parse it.
-							int res = pairing_handle(sensor);
-							if(res > 0){
-								//All is good, return the id of the created pair
-								uint32_t l = 0;
-								cp_encodeU8(buffer, res, &l);
-								REST.set_response_status(response, REST.status.CREATED);
-								REST.set_response_payload(response, buffer, len);
-							}
-							else{
-								switch(res){
-								case 0:
-									REST.set_response_status(response, REST.status.INTERNAL_SERVER_ERROR);
-									break;
-								case -1:
-									REST.set_response_status(response, REST.status.BAD_REQUEST);
-									const char *error_msg1 = "IPAdress wrong";
-									REST.set_response_payload(response, error_msg1, strlen(error_msg1));
-									break;
-								case -2:
-									REST.set_response_status(response, REST.status.BAD_REQUEST);
-									const char *error_msg2 = "Destination URI wrong";
-									REST.set_response_payload(response, error_msg2, strlen(error_msg2));
-									break;
-								case -3:
-									REST.set_response_status(response, REST.status.INTERNAL_SERVER_ERROR);
-									break;
-								case -4:
-									REST.set_response_status(response, REST.status.BAD_REQUEST);
-									const char *error_msg3 = "Source URI wrong";
-									REST.set_response_payload(response, error_msg3, strlen(error_msg3));
-									break;
-								case -5:
-									REST.set_response_status(response, REST.status.NOT_MODIFIED);
-									break;
-								case -6:
-									REST.set_response_status(response, REST.status.INTERNAL_SERVER_ERROR);
-									break;
-								}
-							}
-						}
+			else if(q == q_join){
+				if(joinAssemble(request, response)){
+					//We're finished receiving the payload, now parse it.
+					int res = pairing_handle(sensor, &UIP_IP_BUF->srcipaddr, coap_req->token, coap_req->token_len);
+					if(res > 0){
+						//All is good, return the id of the created pair
+						uint32_t l = 0;
+						cp_encodeU8(buffer, res, &l);
+						REST.set_response_status(response, REST.status.CREATED);
+						REST.set_response_payload(response, buffer, l);
+					}
+					else{
+						joinErrorStatus(response, res);
+					}
 				}
 			}/* join */
+			else if(q == q_joinBatch){
+				//Same as join, but the payload is an array of join messages
+				if(joinAssemble(request, response)){
+					uint8_t ids[PAIRINGS_MAX];
+					int res = pairing_handle_batch(sensor, &UIP_IP_BUF->srcipaddr, coap_req->token, coap_req->token_len, ids, sizeof(ids));
+					if(res > 0){
+						//Return the ids of the created pairs, in the order they were sent
+						uint32_t l = 0;
+						cp_encodeU8Array(buffer, ids, res, &l);
+						REST.set_response_status(response, REST.status.CREATED);
+						REST.set_response_payload(response, buffer, l);
+					}
+					else{
+						joinErrorStatus(response, res);
+					}
+				}
+			}/* joinBatch */
 		}/* len > 0 */
 	}/* sensor != 0 */
 }
@@ -314,7 +583,7 @@ resource_t* res_susensor_activate(const struct susensors_sensor* sensor){
 
 	config = (struct resourceconf*)extra->config;
 	//Create the resource for the coap engine
-	resource_t* r = (resource_t*)memb_alloc(&coap_resources);
+	resource_t* r = (resource_t*)poolAlloc(&coap_resources_pool);
 	if(r == 0)
 		return NULL;
 
@@ -43,6 +43,8 @@
 #include "cmp_helpers.h"
 #include "project-conf.h"
 #include "firmwareUpgrade.h"
+#include "poolstats.h"
+#include "res-query.h"
 extern process_event_t systemchange;
 static void res_sysinfo_gethandler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
 static void res_sysinfo_puthandler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset);
@@ -83,6 +85,43 @@ static int encodeTrailer(uint32_t trailaddr, uint8_t* buffer){
 	return len;
 }
 
+enum sysinfo_query{
+	q_versions,
+	q_coapStatus,
+	q_rplStatus,
+	q_slotNfo,
+	q_memStats,
+	q_readings,
+	q_readingsState,
+	q_activeSlot,
+	q_cfsformat,
+	q_obs,
+	q_upg,
+	q_obsretry,
+	q_swreset,
+};
+
+static const struct query_s getQueries[] = {
+	QUERY("Versions", q_versions),
+	QUERY("CoapStatus", q_coapStatus),
+	QUERY("RPLStatus", q_rplStatus),
+	QUERY("SlotNfo", q_slotNfo),
+	QUERY("MemStats", q_memStats),
+	QUERY("Readings", q_readings),
+	QUERY("ReadingsState", q_readingsState),
+	QUERY("activeSlot", q_activeSlot),
+};
+
+static const struct query_s putQueries[] = {
+	QUERY("cfsformat", q_cfsformat),
+	QUERY("obs", q_obs),
+	QUERY("upg", q_upg),
+#if 0	//Needs reimplementing!
+	QUERY("obsretry", q_obsretry),
+#endif
+	QUERY("swreset", q_swreset),
+};
+
 static void
 res_sysinfo_gethandler(void *request, void *response, uint8_t *buffer, uint16_t preferred_size, int32_t *offset){
 	//REST.set_header_content_type(response, REST.type.TEXT_PLAIN);
@@ -95,8 +134,9 @@ res_sysinfo_gethandler(void *request, void *response, uint8_t *buffer, uint16_t
 	//Pay attention to the max payload length
 	len = REST.get_query(request, &str);
 	if(len > 0){
+		int q = queryFind(getQueries, QUERIES(getQueries), str, len);
 
-		if(strncmp(str, "Versions", len) == 0){
+		if(q == q_versions){
 			len = 0;
 			uint8_t arr[3];
 			arr[0] = SU_VER_MAJOR;
@@ -106,7 +146,7 @@ res_sysinfo_gethandler(void *request, void *response, uint8_t *buffer, uint16_t
 			cp_encodeString(buffer+len, BOARD_STRING, strlen(BOARD_STRING), (uint32_t*)&len);
 			cp_encodeU8Array(buffer+len, arr, sizeof(arr), (uint32_t*)&len);
 		}
-		else if(strncmp(str, "CoapStatus", len) == 0){
+		else if(q == q_coapStatus){
 			len = 0;
 			uint8_t arr[3];
 			int pairtot = 0;
@@ -123,10 +163,10 @@ res_sysinfo_gethandler(void *request, void *response, uint8_t *buffer, uint16_t
 
 			cp_encodeU8Array(buffer, arr, sizeof(arr), (uint32_t*)&len);
 		}
-		else if(strncmp(str, "RPLStatus", len) == 0){
+		else if(q == q_rplStatus){
 
 		}
-		else if(REST.get_query_variable(request, "SlotNfo", &slotnfostr) > 0 && slotnfostr != NULL){
+		else if(q == q_slotNfo && REST.get_query_variable(request, "SlotNfo", &slotnfostr) > 0 && slotnfostr != NULL){
 			if(*slotnfostr == '1'){
 				uint32_t taddr = getTrailAddr(1);
 				if(taddr != 0){
@@ -151,7 +191,21 @@ res_sysinfo_gethandler(void *request, void *response, uint8_t *buffer, uint16_t
 				}
 			}
 		}
-		else if(strncmp(str, "activeSlot", len) == 0){
+		else if(q == q_memStats){
+			//Use of the memory pools, sent blockwise
+			len = poolStatsEncode(buffer, preferred_size, offset);
+			if(len < preferred_size){
+				*offset = -1;
+			}
+		}
+		else if(q == q_readings || q == q_readingsState){
+			//The value of every device in one map, sent blockwise
+			len = susensors_readings(buffer, preferred_size, offset, q == q_readingsState);
+			if(len < preferred_size){
+				*offset = -1;
+			}
+		}
+		else if(q == q_activeSlot){
 			cmp_object_t actslot;
 			actslot.type = CMP_TYPE_UINT8;
 			actslot.as.u8 = getActiveSlot();
@@ -195,11 +249,12 @@ static void res_sysinfo_puthandler(void *request, void *response, uint8_t *buffe
 	coap_packet_t *const coap_req = (coap_packet_t *)request;
 	int len = REST.get_query(request, &str);
 	if(len > 0){
-		if(strncmp(str, "cfsformat", len) == 0){
+		int q = queryFind(putQueries, QUERIES(putQueries), str, len);
+		if(q == q_cfsformat){
 			process_post(PROCESS_BROADCAST, systemchange, NULL);
 			REST.set_response_status(response, REST.status.OK);
 		}
-		else if(strncmp(str, "obs", len) == 0){
+		else if(q == q_obs){
 			if(missingJustCalled(&UIP_IP_BUF->srcipaddr)){
 				REST.set_response_status(response, REST.status.OK);
 			}
@@ -207,7 +262,7 @@ static void res_sysinfo_puthandler(void *request, void *response, uint8_t *buffe
 				REST.set_response_status(response, REST.status.DELETED);
 			}
 		}
-		else if(strncmp(str, "upg", len) == 0){ //Firmware upgrade
+		else if(q == q_upg){ //Firmware upgrade
 			if((len = REST.get_request_payload(request, (const uint8_t **)&payload))) {
 
 				if(fwUpgradeAddChunk(payload, len, coap_req->block1_num, coap_req->block1_offset) == 0){
@@ -237,12 +292,12 @@ static void res_sysinfo_puthandler(void *request, void *response, uint8_t *buffe
 
 		}
 #if 0	//Needs reimplementing!
-		else if(strncmp(str, "obsretry", len) == 0){
+		else if(q == q_obsretry){
 			process_post(&susensors_process, susensors_service, NULL);
 			REST.set_response_status(response, REST.status.OK);
 		}
 #endif
-		else if(strncmp(str, "swreset", len) == 0){
+		else if(q == q_swreset){
 			ctimer_set(&callbacktimer, CLOCK_SECOND, sys_ctrl_reset, NULL);
 			REST.set_response_status(response, REST.status.OK);
 		}
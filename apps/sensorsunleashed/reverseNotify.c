@@ -32,7 +32,6 @@
 
 #include "contiki.h"
 #include "net/ipv6/uiplib.h"
-#include "mmem.h"
 #include "lib/memb.h"
 #include "lib/list.h"
 #include "cfs/cfs.h"
@@ -40,9 +39,11 @@
 #include "susensors.h"
 #include "reverseNotify.h"
 #include "cmp_helpers.h"
+#include "peertable.h"
+#include "poolstats.h"
 
 LIST(revlookup);
-MEMB(revlookup_memb, revlookup_t, 20);
+POOL(revlookup_memb, revlookup_t, REVLOOKUP_MAX);
 
 static void writeFile();
 
@@ -51,10 +52,10 @@ static const char* filename = "revnotify";
 list_t revNotifyInit(){
 	list_init(revlookup);
 	memb_init(&revlookup_memb);
+	poolRegister(&revlookup_memb_pool);
 
 	struct file_s read;
-	read.fd = cfs_open(filename, CFS_READ);
-	read.offset = 0;
+	file_open(&read, filename, CFS_READ);
 
 	if(read.fd < 0) {
 		return revlookup;
@@ -66,36 +67,22 @@ list_t revNotifyInit(){
 
 	while(cmp_read_array(&cmp, &size) == true){
 		if(size != 8) return NULL;
-		revlookup_t* addr = (revlookup_t*)memb_alloc(&revlookup_memb);
+		revlookup_t* addr = (revlookup_t*)poolAlloc(&revlookup_memb_pool);
 		if(addr == NULL) return NULL;
 
 		for(int j=0; j<size; j++){
 			cmp_read_u16(&cmp, &addr->srcip.u16[j]);
 		}
 		list_add(revlookup, addr);
+		peerSetRev(addr);
 	}
-	cfs_close(read.fd);
+	file_close(&read);
 	return revlookup;
 }
 
 static revlookup_t* revNotifyFind(uip_ip6addr_t srcaddr){
-
-	int found = 0;
-	//Find out if the addr is already in our list
-	for(revlookup_t* i = list_head(revlookup); i; i = list_item_next(i)){
-		found = 1;
-		for(int j=0; j<8; j++){
-			if(srcaddr.u16[j] != i->srcip.u16[j]){
-				found = 0;
-				break;
-			}
-		}
-		if(found){
-			return i;
-		}
-	}
-
-	return NULL;
+	peer_t* p = peerFind(&srcaddr);
+	return p != NULL ? p->rev : NULL;
 }
 
 void revNotifyAdd(uip_ip6addr_t srcaddr){
@@ -106,11 +93,12 @@ void revNotifyAdd(uip_ip6addr_t srcaddr){
 	//This will seldom happen, so no need to append to the
 	//list. It only adds complexity
 	if(add){
-		revlookup_t* addr = (revlookup_t*)memb_alloc(&revlookup_memb);
+		revlookup_t* addr = (revlookup_t*)poolAlloc(&revlookup_memb_pool);
 
 		if(addr){
 			memcpy(&addr->srcip, &srcaddr, 16);
 			list_add(revlookup, addr);
+			peerSetRev(addr);
 			writeFile();
 		}
 	}
@@ -119,12 +107,14 @@ void revNotifyAdd(uip_ip6addr_t srcaddr){
 void revNotifyRmAddr(uip_ip6addr_t srcip){
 	revlookup_t* item = revNotifyFind(srcip);
 	if(item != NULL){
+		peerClearRev(item);
 		list_remove(revlookup, item);
 		memb_free(&revlookup_memb, item);
 	}
 }
 
 void revNotifyRmItem(revlookup_t* item){
+	peerClearRev(item);
 	list_remove(revlookup, item);
 	memb_free(&revlookup_memb, item);
 	writeFile();
@@ -133,8 +123,7 @@ void revNotifyRmItem(revlookup_t* item){
 static void writeFile(){
 	cmp_ctx_t cmp;
 	struct file_s write;
-	write.fd = cfs_open(filename, CFS_READ | CFS_WRITE );
-	write.offset = 0;
+	file_open(&write, filename, CFS_READ | CFS_WRITE );
 
 	if(write.fd < 0) {
 		return;
@@ -154,6 +143,6 @@ static void writeFile(){
 		}
 	}
 
-	cfs_close(write.fd);
+	file_close(&write);
 }
 
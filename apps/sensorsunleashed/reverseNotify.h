@@ -35,6 +35,8 @@
 
 #include "net/ipv6/uiplib.h"
 
+#define REVLOOKUP_MAX	20
+
 struct __attribute__ ((__packed__)) revlookup_s{
 	struct revlookup_s *next;
 	uip_ip6addr_t srcip;
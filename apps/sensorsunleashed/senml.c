@@ -0,0 +1,225 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#include <string.h>
+#include "senml.h"
+
+/* SenML labels, RFC 8428 section 6 */
+#define LABEL_BASENAME	-2
+#define LABEL_NAME		0
+#define LABEL_UNIT		1
+#define LABEL_VALUE		2
+#define LABEL_BOOLVALUE	4
+#define LABEL_TIME		6
+
+/* CBOR major types */
+#define CBOR_UINT		0
+#define CBOR_NINT		1
+#define CBOR_TEXT		3
+#define CBOR_ARRAY		4
+#define CBOR_MAP		5
+#define CBOR_SIMPLE		7
+
+static void cborWrite(struct senml_s* s, const void* data, uint32_t len){
+	if(s->mem.error) return;
+	if(len > (uint32_t)(s->mem.end - s->mem.ptr)){
+		s->mem.error = 1;
+		return;
+	}
+	memcpy(s->mem.ptr, data, len);
+	s->mem.ptr += len;
+}
+
+/* Write a value big endian, as CBOR wants it */
+static void cborWriteBE(struct senml_s* s, uint64_t v, int bytes){
+	uint8_t tmp[8];
+	for(int i=bytes-1; i>=0; i--){
+		tmp[i] = v & 0xff;
+		v >>= 8;
+	}
+	cborWrite(s, tmp, bytes);
+}
+
+/* The initial byte of an item, with the value in the smallest size */
+static void cborHead(struct senml_s* s, uint8_t major, uint64_t v){
+	uint8_t head = major << 5;
+	if(v < 24){
+		head |= v;
+		cborWrite(s, &head, 1);
+	}
+	else if(v <= UINT8_MAX){
+		head |= 24;
+		cborWrite(s, &head, 1);
+		cborWriteBE(s, v, 1);
+	}
+	else if(v <= UINT16_MAX){
+		head |= 25;
+		cborWrite(s, &head, 1);
+		cborWriteBE(s, v, 2);
+	}
+	else if(v <= UINT32_MAX){
+		head |= 26;
+		cborWrite(s, &head, 1);
+		cborWriteBE(s, v, 4);
+	}
+	else{
+		head |= 27;
+		cborWrite(s, &head, 1);
+		cborWriteBE(s, v, 8);
+	}
+}
+
+static void cborInt(struct senml_s* s, int64_t v){
+	if(v < 0){
+		cborHead(s, CBOR_NINT, (uint64_t)(-1 - v));
+	}
+	else{
+		cborHead(s, CBOR_UINT, v);
+	}
+}
+
+static void cborText(struct senml_s* s, const char* str, uint32_t len){
+	cborHead(s, CBOR_TEXT, len);
+	cborWrite(s, str, len);
+}
+
+/* Doubles that are exact as a float are sent as a float */
+static void cborDouble(struct senml_s* s, double d){
+	float f = (float)d;
+	uint8_t head;
+	if((double)f == d || d != d){
+		uint32_t bits;
+		memcpy(&bits, &f, sizeof(bits));
+		head = (CBOR_SIMPLE << 5) | 26;
+		cborWrite(s, &head, 1);
+		cborWriteBE(s, bits, 4);
+	}
+	else{
+		uint64_t bits;
+		memcpy(&bits, &d, sizeof(bits));
+		head = (CBOR_SIMPLE << 5) | 27;
+		cborWrite(s, &head, 1);
+		cborWriteBE(s, bits, 8);
+	}
+}
+
+/*
+ * Write the value of a record, as label and value. Integers are only
+ * sent as integers when they are not scaled.
+ * Returns 1 if the type can not be sent
+ * */
+static int senmlValue(struct senml_s* s, const cmp_object_t* obj){
+	int64_t i = 0;
+	double d = 0;
+	int isfloat = 0;
+
+	switch(obj->type){
+	case CMP_TYPE_BOOLEAN:
+		cborInt(s, LABEL_BOOLVALUE);
+		uint8_t b = (CBOR_SIMPLE << 5) | (obj->as.boolean ? 21 : 20);
+		cborWrite(s, &b, 1);
+		return 0;
+	case CMP_TYPE_POSITIVE_FIXNUM:
+	case CMP_TYPE_UINT8: i = obj->as.u8; break;
+	case CMP_TYPE_UINT16: i = obj->as.u16; break;
+	case CMP_TYPE_UINT32: i = obj->as.u32; break;
+	case CMP_TYPE_UINT64: i = obj->as.u64 > INT64_MAX ? INT64_MAX : (int64_t)obj->as.u64; break;
+	case CMP_TYPE_NEGATIVE_FIXNUM:
+	case CMP_TYPE_SINT8: i = obj->as.s8; break;
+	case CMP_TYPE_SINT16: i = obj->as.s16; break;
+	case CMP_TYPE_SINT32: i = obj->as.s32; break;
+	case CMP_TYPE_SINT64: i = obj->as.s64; break;
+	case CMP_TYPE_FLOAT: d = obj->as.flt; isfloat = 1; break;
+	case CMP_TYPE_DOUBLE: d = obj->as.dbl; isfloat = 1; break;
+	default:
+		return 1;
+	}
+
+	cborInt(s, LABEL_VALUE);
+	if(!isfloat && s->resolution <= 1){
+		cborInt(s, i);
+	}
+	else{
+		d = isfloat ? d : (double)i;
+		cborDouble(s, s->resolution > 1 ? d / s->resolution : d);
+	}
+	return 0;
+}
+
+/* Start a pack with a fixed number of records */
+void senmlOpen(struct senml_s* s, uint8_t* buffer, uint32_t size, uint32_t resolution, uint8_t records){
+	mem_open(&s->mem, buffer, size);
+	s->resolution = resolution;
+	cborHead(s, CBOR_ARRAY, records);
+}
+
+/*
+ * Write a record. The basename is not '\0' terminated, as it is most
+ * often the url of the request.
+ * time is in seconds relative to now (negative is in the past).
+ * */
+void senmlRecord(struct senml_s* s, const char* basename, uint32_t basenamelen, const char* name,
+		const char* unit, int32_t time, const cmp_object_t* value){
+	uint8_t fields = 1;
+
+	fields += basename != NULL;
+	fields += name != NULL;
+	fields += unit != NULL && *unit != 0;
+	fields += time != 0;
+
+	cborHead(s, CBOR_MAP, fields);
+	if(basename != NULL){
+		cborInt(s, LABEL_BASENAME);
+		cborText(s, basename, basenamelen);
+	}
+	if(name != NULL){
+		cborInt(s, LABEL_NAME);
+		cborText(s, name, strlen(name));
+	}
+	if(unit != NULL && *unit != 0){
+		cborInt(s, LABEL_UNIT);
+		cborText(s, unit, strlen(unit));
+	}
+	if(time != 0){
+		cborInt(s, LABEL_TIME);
+		cborInt(s, time);
+	}
+	if(senmlValue(s, value) != 0){
+		s->mem.error = 1;
+	}
+}
+
+/* Returns the length of the pack, or -1 if it did not fit or had an unsupported value */
+int32_t senmlClose(struct senml_s* s, uint8_t* buffer){
+	if(s->mem.error) return -1;
+	return mem_used(&s->mem, buffer);
+}
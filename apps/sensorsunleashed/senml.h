@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#ifndef SENSORSUNLEASHED_SENML_H_
+#define SENSORSUNLEASHED_SENML_H_
+
+#include "cmp_helpers.h"
+
+/* CoAP content format of application/senml+cbor (RFC 8428) */
+#define SENML_CBOR_FORMAT	112
+
+/*
+ * SenML CBOR encoder, writing directly into the response buffer.
+ * A pack is opened with the number of records, and each record is
+ * then written with the fields it has; names, units and times are
+ * left out when they are NULL or 0.
+ * If the buffer is too small, the error of the context is set and
+ * the pack can not be used.
+ * */
+struct senml_s{
+	struct mem_s mem;
+	uint32_t resolution;	//Values are sent as value/resolution, see struct resourceconf
+};
+
+void senmlOpen(struct senml_s* s, uint8_t* buffer, uint32_t size, uint32_t resolution, uint8_t records);
+void senmlRecord(struct senml_s* s, const char* basename, uint32_t basenamelen, const char* name,
+		const char* unit, int32_t time, const cmp_object_t* value);
+int32_t senmlClose(struct senml_s* s, uint8_t* buffer);
+
+#endif /* SENSORSUNLEASHED_SENML_H_ */
@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#include <string.h>
+#include "contiki.h"
+#include "lib/memb.h"
+#include "slab.h"
+
+/* Words, so the blocks are aligned */
+struct block16_s{ uint32_t w[16/4]; };
+struct block32_s{ uint32_t w[32/4]; };
+struct block64_s{ uint32_t w[64/4]; };
+struct block128_s{ uint32_t w[128/4]; };
+
+MEMB(slab16, struct block16_s, SLAB_BLOCKS_16);
+MEMB(slab32, struct block32_s, SLAB_BLOCKS_32);
+MEMB(slab64, struct block64_s, SLAB_BLOCKS_64);
+MEMB(slab128, struct block128_s, SLAB_BLOCKS_128);
+
+static struct memb* pools[SLAB_CLASSES] = { &slab16, &slab32, &slab64, &slab128 };
+static struct slab_stats_s stats[SLAB_CLASSES];
+
+void slab_init(){
+	for(int i=0; i<SLAB_CLASSES; i++){
+		memb_init(pools[i]);
+		memset(&stats[i], 0, sizeof(struct slab_stats_s));
+		stats[i].size = pools[i]->size;
+		stats[i].blocks = pools[i]->num;
+	}
+}
+
+//Return a block of at least size bytes, or NULL
+void* slab_alloc(uint16_t size){
+	int first = -1;
+
+	for(int i=0; i<SLAB_CLASSES; i++){
+		if(size > stats[i].size) continue;
+		if(first < 0) first = i;
+
+		void* ptr = memb_alloc(pools[i]);
+		if(ptr != NULL){
+			struct slab_stats_s* st = &stats[i];
+			st->used++;
+			st->wasted += st->size - size;
+			if(st->used > st->peak) st->peak = st->used;
+			return ptr;
+		}
+	}
+
+	if(first >= 0) stats[first].failed++;
+	return NULL;
+}
+
+//Free a block from slab_alloc, size is the size it was allocated with
+void slab_free(void* ptr, uint16_t size){
+	if(ptr == NULL) return;
+
+	for(int i=0; i<SLAB_CLASSES; i++){
+		if(memb_inmemb(pools[i], ptr)){
+			memb_free(pools[i], ptr);
+			stats[i].used--;
+			stats[i].wasted -= stats[i].size - size;
+			return;
+		}
+	}
+}
+
+//Return the statistics of a size class, or NULL if there is no such class
+const struct slab_stats_s* slab_stats(uint8_t class){
+	if(class >= SLAB_CLASSES) return NULL;
+	return &stats[class];
+}
@@ -0,0 +1,100 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#ifndef SENSORSUNLEASHED_SLAB_H_
+#define SENSORSUNLEASHED_SLAB_H_
+
+#include "contiki.h"
+#include "urltable.h"
+
+/*
+ * Allocator for the small blocks of memory the app needs, like the
+ * shared urls. Each size class is a pool of blocks of the same size,
+ * so a block never moves, and allocating or freeing it does not
+ * depend on what else is allocated. A request is served from the
+ * smallest class it fits in, or a larger one if that is used up.
+ *
+ * The blocks are sized for the url table: there is a block for each
+ * of its URLS_MAX entries, as long as the urls are shorter than 32
+ * bytes. Only SLAB_BLOCKS_64 + SLAB_BLOCKS_128 urls can be longer.
+ * */
+#ifdef SLAB_CONF_BLOCKS_16
+#define SLAB_BLOCKS_16	SLAB_CONF_BLOCKS_16
+#else
+#define SLAB_BLOCKS_16	8
+#endif
+
+/* The rest of the url table, the base urls with an event suffix mostly ends up here */
+#ifdef SLAB_CONF_BLOCKS_32
+#define SLAB_BLOCKS_32	SLAB_CONF_BLOCKS_32
+#elif URLS_MAX > SLAB_BLOCKS_16 + SLAB_BLOCKS_64 + SLAB_BLOCKS_128
+#define SLAB_BLOCKS_32	(URLS_MAX - SLAB_BLOCKS_16 - SLAB_BLOCKS_64 - SLAB_BLOCKS_128)
+#else
+#define SLAB_BLOCKS_32	1
+#endif
+
+#ifdef SLAB_CONF_BLOCKS_64
+#define SLAB_BLOCKS_64	SLAB_CONF_BLOCKS_64
+#else
+#define SLAB_BLOCKS_64	2
+#endif
+
+#ifdef SLAB_CONF_BLOCKS_128
+#define SLAB_BLOCKS_128	SLAB_CONF_BLOCKS_128
+#else
+#define SLAB_BLOCKS_128	1
+#endif
+
+#define SLAB_CLASSES	4
+
+#if SLAB_BLOCKS_16 + SLAB_BLOCKS_32 + SLAB_BLOCKS_64 + SLAB_BLOCKS_128 < URLS_MAX
+#error "The slab must have a block for each of the URLS_MAX urls"
+#endif
+#if SLAB_BLOCKS_16 > 255 || SLAB_BLOCKS_32 > 255 || SLAB_BLOCKS_64 > 255 || SLAB_BLOCKS_128 > 255
+#error "The block counts of the slab statistics are uint8_t"
+#endif
+
+struct slab_stats_s{
+	uint16_t size;		//Bytes in a block
+	uint8_t blocks;		//Blocks in the class
+	uint8_t used;
+	uint8_t peak;		//Most blocks used at once
+	uint16_t failed;	//Requests that fitted this class, but got no block at all
+	uint16_t wasted;	//Bytes of the used blocks that was not asked for
+};
+
+void slab_init();
+void* slab_alloc(uint16_t size);
+void slab_free(void* ptr, uint16_t size);
+const struct slab_stats_s* slab_stats(uint8_t class);
+
+#endif /* SENSORSUNLEASHED_SLAB_H_ */
@@ -30,10 +30,10 @@
  * This file is part of the Sensors Unleashed project
  *******************************************************************************/
 
+#include <string.h>
 #include "susensorcommon.h"
 #include "deviceSetup.h"
 
-
 int suconfig(struct susensors_sensor* this, int type, void* data){
 
 	int ret = 1;
@@ -55,56 +55,36 @@ int suconfig(struct susensors_sensor* this, int type, void* data){
 		 *	3: ChangeEvent was not right
 		 *	4: eventsActive was not right
 		 * */
-		uint8_t* payload = (uint8_t*)data;
+		const uint8_t* payload = ((struct supayload_s*)data)->data;
+		uint32_t size = ((struct supayload_s*)data)->len;
 		uint32_t bufindex;
-		int len = 0;
+		uint32_t len = 0;
 
 		cmp_object_t newval;
+		suvalue_t above, below, change;
 		/* Read the AboveEventAt object */
-		if(cp_decodeObject((uint8_t*)payload + len, &newval, &bufindex) == 0){
-			len += bufindex;
-			if(newval.type == setting->AboveEventAt.type){
-				setting->AboveEventAt = newval;
-			}
-			else{
-				return 1;
-			}
-		}
-		else{
-			return 1;
-		}
+		if(cp_decodeObject(payload + len, size - len, &newval, &bufindex) != 0) return 1;
+		if(suvalueFromObject(setting->valuetype, &above, &newval) != 0) return 1;
+		len += bufindex;
 
 		/* Read the BelowEventAt object */
-		if(cp_decodeObject((uint8_t*)payload + len, &newval, &bufindex) == 0){
-			len += bufindex;
-			if(newval.type == setting->BelowEventAt.type){
-				setting->BelowEventAt = newval;
-			}
-			else{
-				return 2;
-			}
-		}
-		else{
-			return 2;
-		}
+		if(cp_decodeObject(payload + len, size - len, &newval, &bufindex) != 0) return 2;
+		if(suvalueFromObject(setting->valuetype, &below, &newval) != 0) return 2;
+		len += bufindex;
+
 		/* Read the ChangeEvent object */
-		if(cp_decodeObject((uint8_t*)payload + len, &newval, &bufindex) == 0){
-			len += bufindex;
-			if(newval.type == setting->ChangeEvent.type){
-				setting->ChangeEvent = newval;
-			}
-			else{
-				return 3;
-			}
-		}
-		else{
-			return 3;
-		}
+		if(cp_decodeObject(payload + len, size - len, &newval, &bufindex) != 0) return 3;
+		if(suvalueFromObject(setting->valuetype, &change, &newval) != 0) return 3;
+		len += bufindex;
+
 		/* Read the eventsActive object */
-		if(cp_decodeObject((uint8_t*)payload + len, &newval, &bufindex) == 0){
+		if(cp_decodeObject(payload + len, size - len, &newval, &bufindex) == 0){
 			len += bufindex;
 			if(newval.type == CMP_TYPE_UINT8){
 				setting->eventsActive = newval.as.u8;
+				setting->AboveEventAt = above;
+				setting->BelowEventAt = below;
+				setting->ChangeEvent = change;
 			}
 			else{
 				return 4;
@@ -113,44 +93,43 @@ int suconfig(struct susensors_sensor* this, int type, void* data){
 		else{
 			return 4;
 		}
+		thresholdNormalize(setting);
 		return 0;
 	}
 	else if(cmd == SUSENSORS_EVENTSETUP_GET){
 		uint8_t* bufptr = (uint8_t*)data;
-		cmp_object_t eventsActive;
-		eventsActive.type = CMP_TYPE_UINT8;
-		eventsActive.as.u8 = setting->eventsActive;
+		cmp_object_t obj;
 
-		bufptr += cp_encodeObject(bufptr, &setting->AboveEventAt);
-		bufptr += cp_encodeObject(bufptr, &setting->BelowEventAt);
-		bufptr += cp_encodeObject(bufptr, &setting->ChangeEvent);
-		bufptr += cp_encodeObject(bufptr, &eventsActive);
+		suvalueToObject(setting->valuetype, &setting->AboveEventAt, &obj);
+		bufptr += cp_encodeObject(bufptr, &obj);
+		suvalueToObject(setting->valuetype, &setting->BelowEventAt, &obj);
+		bufptr += cp_encodeObject(bufptr, &obj);
+		suvalueToObject(setting->valuetype, &setting->ChangeEvent, &obj);
+		bufptr += cp_encodeObject(bufptr, &obj);
+		obj.type = CMP_TYPE_UINT8;
+		obj.as.u8 = setting->eventsActive;
+		bufptr += cp_encodeObject(bufptr, &obj);
 
 		ret = (uint8_t*)data - bufptr;
 	}
 	else if(cmd == SUSENSORS_CEVENT_GET){
-		cmp_object_t* obj = (cmp_object_t*)data;
-		*obj = setting->ChangeEvent;
+		suvalueToObject(setting->valuetype, &setting->ChangeEvent, (cmp_object_t*)data);
 		ret = 0;
 	}
 	else if(cmd == SUSENSORS_AEVENT_GET){
-		cmp_object_t* obj = (cmp_object_t*)data;
-		*obj = setting->AboveEventAt;
+		suvalueToObject(setting->valuetype, &setting->AboveEventAt, (cmp_object_t*)data);
 		ret = 0;
 	}
 	else if(cmd == SUSENSORS_BEVENT_GET){
-		cmp_object_t* obj = (cmp_object_t*)data;
-		*obj = setting->BelowEventAt;
+		suvalueToObject(setting->valuetype, &setting->BelowEventAt, (cmp_object_t*)data);
 		ret = 0;
 	}
 	else if(cmd == SUSENSORS_RANGEMAX_GET){
-		cmp_object_t* obj = (cmp_object_t*)data;
-		*obj = setting->RangeMax;
+		suvalueToObject(setting->valuetype, &setting->RangeMax, (cmp_object_t*)data);
 		ret = 0;
 	}
 	else if(cmd == SUSENSORS_RANGEMIN_GET){
-		cmp_object_t* obj = (cmp_object_t*)data;
-		*obj = setting->RangeMin;
+		suvalueToObject(setting->valuetype, &setting->RangeMin, (cmp_object_t*)data);
 		ret = 0;
 	}
 	else if(cmd == SUSENSORS_EVENTSTATE_GET){
@@ -159,6 +138,62 @@ int suconfig(struct susensors_sensor* this, int type, void* data){
 		obj->as.u8 = setting->eventsActive;
 		ret = 0;
 	}
+	else if(cmd == SUSENSORS_EVENTLIMITS_SET){
+		/* The limits are received as a fixed list of cmp_objects:
+		 * 1. Hysteresis
+		 * 2. NotifyInterval (ms)
+		 * */
+
+		/* Returns
+		 *  0: Success
+		 *  1: Hysteresis was not right
+		 *  2: NotifyInterval was not right
+		 * */
+		const uint8_t* payload = ((struct supayload_s*)data)->data;
+		uint32_t size = ((struct supayload_s*)data)->len;
+		uint32_t bufindex;
+		cmp_object_t obj;
+		cmp_object_t interval;
+		suvalue_t hysteresis;
+
+		//nil turns the hysteresis off
+		if(cp_decodeObject(payload, size, &obj, &bufindex) != 0) return 1;
+		if(obj.type == CMP_TYPE_NIL){
+			memset(&hysteresis, 0, sizeof(hysteresis));
+		}
+		else if(suvalueFromObject(setting->valuetype, &hysteresis, &obj) != 0){
+			return 1;
+		}
+		payload += bufindex;
+		size -= bufindex;
+
+		if(cp_decodeObject(payload, size, &interval, &bufindex) != 0) return 2;
+		if(interval.type == CMP_TYPE_UINT16){
+			setting->NotifyInterval = interval.as.u16;
+		}
+		else if(interval.type == CMP_TYPE_UINT8 || interval.type == CMP_TYPE_POSITIVE_FIXNUM){
+			setting->NotifyInterval = interval.as.u8;
+		}
+		else{
+			return 2;
+		}
+
+		setting->Hysteresis = hysteresis;
+		thresholdNormalize(setting);
+		return 0;
+	}
+	else if(cmd == SUSENSORS_EVENTLIMITS_GET){
+		uint8_t* bufptr = (uint8_t*)data;
+		cmp_object_t obj;
+
+		suvalueToObject(setting->valuetype, &setting->Hysteresis, &obj);
+		bufptr += cp_encodeObject(bufptr, &obj);
+		obj.type = CMP_TYPE_UINT16;
+		obj.as.u16 = setting->NotifyInterval;
+		bufptr += cp_encodeObject(bufptr, &obj);
+
+		ret = bufptr - (uint8_t*)data;
+	}
 	else if(cmd == SUSENSORS_STORE_SETUP){
 		deviceSetupSave(this->type, setting);
 		ret = 0;
@@ -170,118 +205,291 @@ void setResource(struct susensors_sensor* this, resource_t* res){
 	this->data.resource = res;
 }
 
-/**
- *
- * @param this
- * 	The actual sensor instance
- * @param dir
- * 	The direction of the last value
- * @param step
- * 	The step from from last time the actuator was set
- * @return
- */
-void setEventU8(struct susensors_sensor* this, int dir, uint8_t step){
-	settings_t* c = this->data.setting;
-	struct relayRuntime* r = (struct relayRuntime*)(this->data.runtime);
-	uint8_t event = 0;
+/*
+ * Convert a device value to a cmp object of the devices type.
+ * Unsupported types gives a nil object.
+ * */
+void suvalueToObject(uint8_t type, const suvalue_t* v, cmp_object_t* obj){
+	obj->type = type;
+	switch(type){
+	case CMP_TYPE_BOOLEAN: obj->as.boolean = v->boolean; break;
+	case CMP_TYPE_POSITIVE_FIXNUM:
+	case CMP_TYPE_UINT8: obj->as.u8 = v->u8; break;
+	case CMP_TYPE_UINT16: obj->as.u16 = v->u16; break;
+	case CMP_TYPE_UINT32: obj->as.u32 = v->u32; break;
+	case CMP_TYPE_NEGATIVE_FIXNUM:
+	case CMP_TYPE_SINT8: obj->as.s8 = v->s8; break;
+	case CMP_TYPE_SINT16: obj->as.s16 = v->s16; break;
+	case CMP_TYPE_SINT32: obj->as.s32 = v->s32; break;
+	case CMP_TYPE_FLOAT: obj->as.flt = v->flt; break;
+#if SUSENSORS_WIDE_VALUES
+	case CMP_TYPE_UINT64: obj->as.u64 = v->u64; break;
+	case CMP_TYPE_SINT64: obj->as.s64 = v->s64; break;
+	case CMP_TYPE_DOUBLE: obj->as.dbl = v->dbl; break;
+#endif
+	default: obj->type = CMP_TYPE_NIL; break;
+	}
+}
 
-	r->hasEvent = NoEventActive;
-	if(dir < 0){
-		if(r->LastEventValue.as.u8 > c->BelowEventAt.as.u8){
-			if(r->LastValue.as.u8 <= c->BelowEventAt.as.u8 && (c->eventsActive & BelowEventActive)){
-				r->hasEvent = BelowEventActive;
-				event |= SUSENSORS_BELOW_EVENT;
-			}
-		}
+/*
+ * Convert a received cmp object to a device value of the given type.
+ * The object does not have to be of the same type, only the value has
+ * to fit, ex. a fixnum can be used for an uint16 device.
+ * Returns
+ * 	0: Success
+ * 	1: The value does not fit the type, or the type is not supported
+ * */
+int suvalueFromObject(uint8_t type, suvalue_t* v, const cmp_object_t* obj){
+	int64_t i;
+	double d;
+	int isint = 1;
+
+	switch(obj->type){
+	case CMP_TYPE_POSITIVE_FIXNUM:
+	case CMP_TYPE_UINT8: i = obj->as.u8; break;
+	case CMP_TYPE_UINT16: i = obj->as.u16; break;
+	case CMP_TYPE_UINT32: i = obj->as.u32; break;
+	case CMP_TYPE_UINT64:
+		if(obj->as.u64 > INT64_MAX) return 1;
+		i = (int64_t)obj->as.u64;
+		break;
+	case CMP_TYPE_NEGATIVE_FIXNUM:
+	case CMP_TYPE_SINT8: i = obj->as.s8; break;
+	case CMP_TYPE_SINT16: i = obj->as.s16; break;
+	case CMP_TYPE_SINT32: i = obj->as.s32; break;
+	case CMP_TYPE_SINT64: i = obj->as.s64; break;
+	case CMP_TYPE_FLOAT: d = obj->as.flt; isint = 0; break;
+	case CMP_TYPE_DOUBLE: d = obj->as.dbl; isint = 0; break;
+	case CMP_TYPE_BOOLEAN:
+		if(type != CMP_TYPE_BOOLEAN) return 1;
+		v->boolean = obj->as.boolean;
+		return 0;
+	default:
+		return 1;
 	}
-	else{
-		if(r->LastEventValue.as.u8 < c->AboveEventAt.as.u8){
-			if(r->LastValue.as.u8 >= c->AboveEventAt.as.u8 && (c->eventsActive & AboveEventActive)){
-				r->hasEvent = AboveEventActive;
-				event |= SUSENSORS_ABOVE_EVENT;
-			}
-		}
+
+	//Floats are not rounded into integer devices
+	switch(type){
+	case CMP_TYPE_FLOAT: v->flt = isint ? (float)i : (float)d; return 0;
+#if SUSENSORS_WIDE_VALUES
+	case CMP_TYPE_DOUBLE: v->dbl = isint ? (double)i : d; return 0;
+#endif
 	}
+	if(!isint) return 1;
 
-	r->ChangeEventAcc.as.u8 += step;
-	if(c->ChangeEvent.as.u8 <= r->ChangeEventAcc.as.u8){
-		r->ChangeEventAcc.as.u8 = 0;
-		if(c->eventsActive & ChangeEventActive){
-			r->hasEvent |= ChangeEventActive;
-			event |= SUSENSORS_CHANGE_EVENT;
-		}
+	switch(type){
+	case CMP_TYPE_POSITIVE_FIXNUM:
+	case CMP_TYPE_UINT8:
+		if(i < 0 || i > UINT8_MAX) return 1;
+		v->u8 = (uint8_t)i;
+		break;
+	case CMP_TYPE_UINT16:
+		if(i < 0 || i > UINT16_MAX) return 1;
+		v->u16 = (uint16_t)i;
+		break;
+	case CMP_TYPE_UINT32:
+		if(i < 0 || i > UINT32_MAX) return 1;
+		v->u32 = (uint32_t)i;
+		break;
+	case CMP_TYPE_NEGATIVE_FIXNUM:
+	case CMP_TYPE_SINT8:
+		if(i < INT8_MIN || i > INT8_MAX) return 1;
+		v->s8 = (int8_t)i;
+		break;
+	case CMP_TYPE_SINT16:
+		if(i < INT16_MIN || i > INT16_MAX) return 1;
+		v->s16 = (int16_t)i;
+		break;
+	case CMP_TYPE_SINT32:
+		if(i < INT32_MIN || i > INT32_MAX) return 1;
+		v->s32 = (int32_t)i;
+		break;
+#if SUSENSORS_WIDE_VALUES
+	case CMP_TYPE_UINT64:
+		if(i < 0) return 1;
+		v->u64 = (uint64_t)i;
+		break;
+	case CMP_TYPE_SINT64:
+		v->s64 = i;
+		break;
+#endif
+	default:
+		return 1;
 	}
+	return 0;
+}
 
-	if(r->hasEvent != NoEventActive){
-		r->LastEventValue = r->LastValue;
-		susensors_changed(this, event);
+/*
+ * Key functions - one per cmp type.
+ * Integers are biased, so that negative values are ordered below
+ * positive ones. Floats are ordered by their bit pattern, where the
+ * negative ones are inverted.
+ * */
+#define KEY_BIAS	0x8000000000000000ULL
+
+static uint64_t key_u8(const suvalue_t* v) { return (uint64_t)v->u8 ^ KEY_BIAS; }
+static uint64_t key_u16(const suvalue_t* v) { return (uint64_t)v->u16 ^ KEY_BIAS; }
+static uint64_t key_u32(const suvalue_t* v) { return (uint64_t)v->u32 ^ KEY_BIAS; }
+static uint64_t key_s8(const suvalue_t* v) { return (uint64_t)(int64_t)v->s8 ^ KEY_BIAS; }
+static uint64_t key_s16(const suvalue_t* v) { return (uint64_t)(int64_t)v->s16 ^ KEY_BIAS; }
+static uint64_t key_s32(const suvalue_t* v) { return (uint64_t)(int64_t)v->s32 ^ KEY_BIAS; }
+static uint64_t key_bool(const suvalue_t* v) { return (uint64_t)(v->boolean != 0) ^ KEY_BIAS; }
+
+static uint64_t key_dblbits(double d){
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	return (bits & KEY_BIAS) ? ~bits : bits | KEY_BIAS;
+}
+static uint64_t key_flt(const suvalue_t* v) { return key_dblbits(v->flt); }
+
+#if SUSENSORS_WIDE_VALUES
+static uint64_t key_u64(const suvalue_t* v) { return v->u64 ^ KEY_BIAS; }	//Values above 2^63 are not supported
+static uint64_t key_s64(const suvalue_t* v) { return (uint64_t)v->s64 ^ KEY_BIAS; }
+static uint64_t key_dbl(const suvalue_t* v) { return key_dblbits(v->dbl); }
+#endif
+
+static const threshold_key_t keytable[] = {
+	[CMP_TYPE_POSITIVE_FIXNUM] = key_u8,
+	[CMP_TYPE_BOOLEAN] = key_bool,
+	[CMP_TYPE_FLOAT] = key_flt,
+	[CMP_TYPE_UINT8] = key_u8,
+	[CMP_TYPE_UINT16] = key_u16,
+	[CMP_TYPE_UINT32] = key_u32,
+	[CMP_TYPE_SINT8] = key_s8,
+	[CMP_TYPE_SINT16] = key_s16,
+	[CMP_TYPE_SINT32] = key_s32,
+#if SUSENSORS_WIDE_VALUES
+	[CMP_TYPE_DOUBLE] = key_dbl,
+	[CMP_TYPE_UINT64] = key_u64,
+	[CMP_TYPE_SINT64] = key_s64,
+#endif
+	[CMP_TYPE_NEGATIVE_FIXNUM] = key_s8,
+};
+
+static threshold_key_t getKeyFunction(uint8_t type){
+	if(type >= sizeof(keytable) / sizeof(keytable[0])) return NULL;
+	return keytable[type];
+}
+
+/* Size of a change step, saturated to 32bit */
+static uint32_t getStep(uint8_t type, const suvalue_t* v){
+	int64_t s;
+	switch(type){
+	case CMP_TYPE_POSITIVE_FIXNUM:
+	case CMP_TYPE_UINT8: return v->u8;
+	case CMP_TYPE_UINT16: return v->u16;
+	case CMP_TYPE_UINT32: return v->u32;
+	case CMP_TYPE_NEGATIVE_FIXNUM:
+	case CMP_TYPE_SINT8: s = v->s8; break;
+	case CMP_TYPE_SINT16: s = v->s16; break;
+	case CMP_TYPE_SINT32: s = v->s32; break;
+	case CMP_TYPE_FLOAT: s = (int64_t)v->flt; break;		//Whole units only
+#if SUSENSORS_WIDE_VALUES
+	case CMP_TYPE_UINT64: return v->u64 > UINT32_MAX ? UINT32_MAX : (uint32_t)v->u64;
+	case CMP_TYPE_SINT64: s = v->s64; break;
+	case CMP_TYPE_DOUBLE: s = (int64_t)v->dbl; break;
+#endif
+	default: return UINT32_MAX;
 	}
+	s = s < 0 ? -s : s;
+	return s > UINT32_MAX ? UINT32_MAX : (uint32_t)s;
 }
 
-void setEventU16(struct susensors_sensor* this, int dir, uint16_t step){
-	settings_t* c = this->data.setting;
-	struct relayRuntime* r = (struct relayRuntime*)(this->data.runtime);
-	uint8_t event = 0;
+/*
+ * Get the key of a value moved by offset, in the values own type.
+ * Integer keys are linear, so they can be moved directly, floats
+ * has to be converted first.
+ * */
+static uint64_t offsetKey(threshold_key_t key, uint8_t type, const suvalue_t* v, int64_t offset){
+	uint64_t k = key(v);
 
-	r->hasEvent = NoEventActive;
-	if(dir < 0){
-		if(r->LastEventValue.as.u16 > c->BelowEventAt.as.u16){
-			if(r->LastValue.as.u16 <= c->BelowEventAt.as.u16 && (c->eventsActive & BelowEventActive)){
-				r->hasEvent = BelowEventActive;
-				event |= SUSENSORS_BELOW_EVENT;
-			}
-		}
+	if(type == CMP_TYPE_FLOAT){
+		return key_dblbits((double)v->flt + offset);
 	}
-	else{
-		if(r->LastEventValue.as.u16 < c->AboveEventAt.as.u16){
-			if(r->LastValue.as.u16 >= c->AboveEventAt.as.u16 && (c->eventsActive & AboveEventActive)){
-				r->hasEvent = AboveEventActive;
-				event |= SUSENSORS_ABOVE_EVENT;
-			}
-		}
+#if SUSENSORS_WIDE_VALUES
+	else if(type == CMP_TYPE_DOUBLE){
+		return key_dblbits(v->dbl + offset);
 	}
-
-	r->ChangeEventAcc.as.u16 += step;
-	if(c->ChangeEvent.as.u16 <= r->ChangeEventAcc.as.u16){
-		r->ChangeEventAcc.as.u16 = 0;
-		if(c->eventsActive & ChangeEventActive){
-			r->hasEvent |= ChangeEventActive;
-			event |= SUSENSORS_CHANGE_EVENT;
-		}
+#endif
+	else if(offset < 0){
+		return k < (uint64_t)-offset ? 0 : k + offset;
 	}
+	return k > UINT64_MAX - offset ? UINT64_MAX : k + offset;
+}
 
-	if(r->hasEvent != NoEventActive){
-		r->LastEventValue = r->LastValue;
-		susensors_changed(this, event);
+/*
+ * Build the threshold keys from the settings.
+ * Has to be called whenever the event settings are loaded or changed.
+ * Returns
+ * 	0: Success
+ * 	1: The device type can not be used for events
+ * */
+int thresholdNormalize(settings_t* setting){
+	struct threshold_s* t = &setting->threshold;
+	uint8_t type = setting->valuetype;
+
+	t->key = getKeyFunction(type);
+	if(t->key == NULL){
+		return 1;
 	}
+
+	int64_t hysteresis = getStep(type, &setting->Hysteresis);
+
+	t->above = t->key(&setting->AboveEventAt);
+	t->below = t->key(&setting->BelowEventAt);
+	t->aboveRearm = offsetKey(t->key, type, &setting->AboveEventAt, -hysteresis);
+	t->belowRearm = offsetKey(t->key, type, &setting->BelowEventAt, hysteresis);
+	t->change = getStep(type, &setting->ChangeEvent);
+	return 0;
 }
 
-void setEventU32(struct susensors_sensor* this, int dir, uint32_t step){
+/**
+ * Check if the last value of a device should fire an event.
+ * The devices LastValue has to be updated before calling this.
+ * @param this
+ * 	The actual sensor instance
+ * @param dir
+ * 	The direction of the last value
+ * @param step
+ * 	The step from from last time the actuator was set
+ */
+void setEvent(struct susensors_sensor* this, int dir, uint32_t step){
 	settings_t* c = this->data.setting;
+	const struct threshold_s* t = &c->threshold;
 	struct relayRuntime* r = (struct relayRuntime*)(this->data.runtime);
 	uint8_t event = 0;
 
+	if(t->key == NULL) return;
+
+	uint64_t now = t->key(&r->LastValue);
+
+	//Arm the events again, once the value is back outside the hysteresis band
+	if(now < t->aboveRearm){
+		r->disarmed &= ~AboveEventActive;
+	}
+	if(now > t->belowRearm){
+		r->disarmed &= ~BelowEventActive;
+	}
+
 	r->hasEvent = NoEventActive;
 	if(dir < 0){
-		if(r->LastEventValue.as.u32 > c->BelowEventAt.as.u32){
-			if(r->LastValue.as.u32 <= c->BelowEventAt.as.u32 && (c->eventsActive & BelowEventActive)){
-				r->hasEvent = BelowEventActive;
-				event |= SUSENSORS_BELOW_EVENT;
-			}
+		if(!(r->disarmed & BelowEventActive) && now <= t->below && (c->eventsActive & BelowEventActive)){
+			r->hasEvent = BelowEventActive;
+			r->disarmed |= BelowEventActive;
+			event |= SUSENSORS_BELOW_EVENT;
 		}
 	}
 	else{
-		if(r->LastEventValue.as.u32 < c->AboveEventAt.as.u32){
-			if(r->LastValue.as.u32 >= c->AboveEventAt.as.u32 && (c->eventsActive & AboveEventActive)){
-				r->hasEvent = AboveEventActive;
-				event |= SUSENSORS_ABOVE_EVENT;
-			}
+		if(!(r->disarmed & AboveEventActive) && now >= t->above && (c->eventsActive & AboveEventActive)){
+			r->hasEvent = AboveEventActive;
+			r->disarmed |= AboveEventActive;
+			event |= SUSENSORS_ABOVE_EVENT;
 		}
 	}
 
-	r->ChangeEventAcc.as.u32 += step;
-	if(c->ChangeEvent.as.u32 <= r->ChangeEventAcc.as.u32){
-		r->ChangeEventAcc.as.u32 = 0;
+	r->ChangeEventAcc += step;
+	if(t->change <= r->ChangeEventAcc){
+		r->ChangeEventAcc = 0;
 		if(c->eventsActive & ChangeEventActive){
 			r->hasEvent |= ChangeEventActive;
 			event |= SUSENSORS_CHANGE_EVENT;
@@ -296,12 +504,12 @@ void setEventU32(struct susensors_sensor* this, int dir, uint32_t step){
 
 int testevent(struct susensors_sensor* this, int len, uint8_t* payload){
 	uint8_t event, testevent = 0;
-	uint32_t parselen = len;
+	uint32_t parselen;
 	cmp_object_t eventval;
-	if(cp_decodeU8(payload, &event, &parselen) != 0) return 1;
+	if(len <= 0 || cp_decodeU8(payload, len, &event, &parselen) != 0) return 1;
 	payload += parselen;
-	parselen = len - parselen;
-	if(cp_decodeObject(payload, &eventval, &parselen) != 0) return 2;
+	len -= parselen;
+	if(cp_decodeObject(payload, len, &eventval, &parselen) != 0) return 2;
 
 	settings_t* c = this->data.setting;
 
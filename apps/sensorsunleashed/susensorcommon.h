@@ -38,9 +38,10 @@
 
 int suconfig(struct susensors_sensor* this, int type, void* data);
 void setResource(struct susensors_sensor* this, resource_t* res);
-void setEventU8(struct susensors_sensor* this, int dir, uint8_t step);
-void setEventU16(struct susensors_sensor* this, int dir, uint16_t step);
-void setEventU32(struct susensors_sensor* this, int dir, uint32_t step);
+int thresholdNormalize(settings_t* setting);
+void suvalueToObject(uint8_t type, const suvalue_t* v, cmp_object_t* obj);
+int suvalueFromObject(uint8_t type, suvalue_t* v, const cmp_object_t* obj);
+void setEvent(struct susensors_sensor* this, int dir, uint32_t step);
 
 int testevent(struct susensors_sensor* this, int len, uint8_t* payload);
 #endif /* SENSORSUNLEASHED_DEV_SUSENSORCOMMON_H_ */
@@ -32,15 +32,20 @@
 
 #include <string.h>
 #include "contiki.h"
+#include "sys/int-master.h"
 #include "susensors.h"
 #include "lib/memb.h"
 #include "pairing.h"
 #include "rest-engine.h"
 #include "coap-observe.h"
 #include "cmp.h"
+#include "cmp_helpers.h"
 #include "reverseNotify.h"
 #include "coap-engine.h"
 #include "pairgroup.h"
+#include "peertable.h"
+#include "urltable.h"
+#include "poolstats.h"
 
 #define DEBUG 1
 #if DEBUG
@@ -57,6 +62,7 @@
 const char* strAbove = "/above";
 const char* strBelow = "/below";
 const char* strChange = "/change";
+const char* strEvents = "/events";
 
 process_event_t susensors_pair;
 process_event_t susensors_pair_fail;
@@ -65,7 +71,6 @@ process_event_t susensors_presence_success;
 process_event_t susensors_presence_fail;
 process_event_t susensors_new_observer;
 process_event_t susensors_txhandler;
-process_event_t susensors_event_handle;
 
 enum transaction_Priority_e{
 	Priority_Urgent,
@@ -74,11 +79,13 @@ enum transaction_Priority_e{
 	Priority_Low,
 };
 typedef enum transaction_Priority_e transaction_Priority_t;
+#define TRANSACTION_PRIORITIES	(Priority_Low + 1)
+
 /*
  * Highest priority is processed first
  * */
 struct __attribute__ ((__packed__)) transaction_s{
-	struct tx_package_s *next;
+	struct transaction_s *next;
 	transaction_Priority_t priority;
 	process_event_t ev;
 	process_data_t data;
@@ -86,18 +93,114 @@ struct __attribute__ ((__packed__)) transaction_s{
 };
 typedef struct transaction_s transaction_t;
 
+/*
+ * The queue is a FIFO per priority, so that adding a transaction
+ * and taking the next one does not have to search the queue.
+ * */
+struct transaction_fifo_s{
+	transaction_t* head;
+	transaction_t* tail;
+};
 
-#define MAX_ACTIVE_TRANSACTIONS	1
+#ifdef SUSENSORS_CONF_TRANSACTIONS_MAX
+#define TRANSACTIONS_MAX	SUSENSORS_CONF_TRANSACTIONS_MAX
+#else
+#define TRANSACTIONS_MAX	30
+#endif
+
+
+/*
+ * Transactions to different nodes are run in parallel, up to
+ * MAX_ACTIVE_TRANSACTIONS at a time. There is never more than
+ * one active transaction per node, so a node is not flooded
+ * and its transactions are still run in order.
+ * Keep it below COAP_MAX_OPEN_TRANSACTIONS, so that there is
+ * room left for the notifications.
+ * */
+#ifdef SUSENSORS_CONF_MAX_ACTIVE_TRANSACTIONS
+#define MAX_ACTIVE_TRANSACTIONS	SUSENSORS_CONF_MAX_ACTIVE_TRANSACTIONS
+#else
+#define MAX_ACTIVE_TRANSACTIONS	3
+#endif
+
+struct activeTransaction_s{
+	uint8_t used;
+	uip_ip6addr_t addr;
+	process_data_t data;	//The pair or presence the slot was started for
+};
+static struct activeTransaction_s activeSlots[MAX_ACTIVE_TRANSACTIONS];
 static uint8_t activeTransactions = 0;
 
+/*
+ * Device events are queued in a ring, instead of being or'ed into a
+ * flag on the device. This way back-to-back events are not merged,
+ * and the value and time of each event is kept.
+ *
+ * The head is only moved by the producers and the tail only by
+ * susensors_process, so the consumer side needs no locking. Events
+ * can be produced from both interrupts and processes, so claiming
+ * a slot is done with interrupts disabled.
+ * Size must be a power of 2.
+ * */
+#ifdef SUSENSORS_CONF_EVENTQUEUE_SIZE
+#define EVENTQUEUE_SIZE	SUSENSORS_CONF_EVENTQUEUE_SIZE
+#else
+#define EVENTQUEUE_SIZE	16
+#endif
+#if EVENTQUEUE_SIZE < 2 || EVENTQUEUE_SIZE > 256 || (EVENTQUEUE_SIZE & (EVENTQUEUE_SIZE - 1)) != 0
+#error "EVENTQUEUE_SIZE must be a power of 2, and max 256, the indexes are uint8_t"
+#endif
+#define EVENTQUEUE_MASK	(EVENTQUEUE_SIZE - 1)
+#define EVENTQUEUE_BATCH	4	//Max events handled per poll
+
+static suevent_t eventqueue[EVENTQUEUE_SIZE];
+static volatile uint8_t eventqueue_head = 0;
+static volatile uint8_t eventqueue_tail = 0;
+static volatile uint16_t eventqueue_dropped = 0;
+static const suevent_t* current_event = NULL;
+
+/* The value of the current event, encoded once for all subscribers */
+#define SNAPSHOT_SIZE	10	//Largest msgpacked scalar is 9 bytes
+static uint8_t snapshot[SNAPSHOT_SIZE];
+static int snapshotlen = 0;
+
 
 PROCESS(susensors_process, "Sensors");
 
 LIST(sudevices);
-LIST(transactions);
 
-MEMB(sudevices_memb, susensors_sensor_t, DEVICES_MAX);
-MEMB(transactions_memb, transaction_t, 30);
+POOL(sudevices_memb, susensors_sensor_t, DEVICES_MAX);
+
+/*
+ * Index of the device urls, with open addressing and linear probing
+ * as in pairgroup.c. The devices are never removed, so a slot is filled
+ * when the device is added and kept. The hash and length of the url
+ * are kept in the slot, so that a lookup only compares the url once.
+ * */
+#define DEVICETABLE_MASK	(DEVICETABLE_SIZE - 1)
+
+struct devslot_s{
+	susensors_sensor_t* device;		//NULL if the slot is free
+	uint8_t hash;
+	uint8_t len;
+};
+static struct devslot_s devslots[DEVICETABLE_SIZE];
+POOL(transactions_memb, transaction_t, TRANSACTIONS_MAX);
+static struct transaction_fifo_s transactions[TRANSACTION_PRIORITIES];
+static struct susensors_txstats_s txstats;
+
+/*
+ * Reverse index of the local pairs. Every device keeps a list
+ * of the local pairs that subscribes to its events, so that
+ * an event only visits the pairs that actually need it.
+ * */
+struct localpair_s{
+	struct localpair_s *next;
+	joinpair_t* pair;
+};
+typedef struct localpair_s localpair_t;
+
+POOL(localpairs_memb, localpair_t, PAIRINGS_MAX);
 
 void transactionAdd(process_event_t ev, process_data_t data, transaction_Priority_t priority, uip_ip6addr_t addr);
 
@@ -114,28 +217,94 @@ void pair_added(joinpair_t* pair){
 	process_post(&susensors_process, susensors_txhandler, NULL);
 }
 
+static void localPairDisconnect(joinpair_t* pair){
+	susensors_sensor_t* d = pair->localdeviceptr;
+	if(d == 0) return;
+
+	for(localpair_t* lp = list_head(d->localpairs); lp; lp = list_item_next(lp)){
+		if(lp->pair == pair){
+			list_remove(d->localpairs, lp);
+			memb_free(&localpairs_memb, lp);
+			break;
+		}
+	}
+	pair->localdeviceptr = 0;
+}
+
 void pair_removed(joinpair_t* pair){
 
+	if(pair->localhost){
+		localPairDisconnect(pair);
+		return;
+	}
+
 	if(pair->triggers[0] != -1){
-		if(pairGroupRemove(pair, aboveEvent) == 0){
-			coap_remove_observer_by_uri(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), pair->dsturlAbove);
-		}
+		pairGroupRemove(pair, aboveEvent);
 	}
 	if(pair->triggers[1] != -1){
-		if(pairGroupRemove(pair, belowEvent) == 0){
-			coap_remove_observer_by_uri(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), pair->dsturlBelow);
-		}
+		pairGroupRemove(pair, belowEvent);
 	}
 	if(pair->triggers[2] != -1){
-		if(pairGroupRemove(pair, changeEvent) == 0){
-			coap_remove_observer_by_uri(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), pair->dsturlChange);
+		pairGroupRemove(pair, changeEvent);
+	}
+#if SUSENSORS_COMBINED_EVENTS
+	pairGroupRemove(pair, combinedEvent);
+#endif
+}
+
+/* Same hash as urltable.c, one character at a time */
+static uint8_t hashStep(uint8_t h, char c){
+	return (h << 3) + (h >> 5) + c;
+}
+
+static uint8_t deviceHash(const char* url, unsigned short len){
+	uint8_t h = 0;
+	for(unsigned short i=0; i<len; i++){
+		h = hashStep(h, url[i]);
+	}
+	return h;
+}
+
+/* Return the device with exactly the url of len characters, or NULL */
+static susensors_sensor_t* deviceSlot(const char* url, unsigned short len, uint8_t h){
+	uint8_t i = h & DEVICETABLE_MASK;
+
+	for(int n=0; n<DEVICETABLE_SIZE; n++){
+		struct devslot_s* slot = &devslots[i];
+		if(slot->device == NULL) return NULL;
+		if(slot->hash == h && slot->len == len && memcmp(slot->device->type, url, len) == 0){
+			return slot->device;
 		}
+		i = (i + 1) & DEVICETABLE_MASK;
 	}
+	return NULL;
+}
+
+/*
+ * Return the sub resource the rest of the url after the device url
+ * points to, noEvent for the device itself, or -1 if it is not one
+ * the device has.
+ * */
+static int subResource(susensors_sensor_t* d, const char* rest, unsigned short len){
+	if(len == 0) return noEvent;
+	if(!(((struct resourceconf*)(d->data.config))->flags & HAS_SUB_RESOURCES)) return -1;
+
+	if(len == strlen(strAbove) && memcmp(rest, strAbove, len) == 0) return aboveEvent;
+	if(len == strlen(strBelow) && memcmp(rest, strBelow, len) == 0) return belowEvent;
+	if(len == strlen(strChange) && memcmp(rest, strChange, len) == 0) return changeEvent;
+	if(len == strlen(strEvents) && memcmp(rest, strEvents, len) == 0) return combinedEvent;
+	return -1;
 }
 
 void initSUSensors(){
 	list_init(sudevices);
 	memb_init(&sudevices_memb);
+	memset(devslots, 0, sizeof(devslots));
+	memb_init(&localpairs_memb);
+	poolRegister(&sudevices_memb_pool);
+	poolRegister(&localpairs_memb_pool);
+	poolRegister(&transactions_memb_pool);
+	peerTableInit();
 
 	/* Initialize the REST engine. */
 	rest_init_engine();
@@ -146,13 +315,26 @@ void initSUSensors(){
 
 susensors_sensor_t* addSUDevices(susensors_sensor_t* device){
 	susensors_sensor_t* d;
-	d = memb_alloc(&sudevices_memb);
+	d = poolAlloc(&sudevices_memb_pool);
 	if(d == 0) return NULL;
 
 	memcpy(d, device, sizeof(susensors_sensor_t));
 	LIST_STRUCT_INIT(d, pairs);
+	LIST_STRUCT_INIT(d, localpairs);
+	d->pending.event = 0;
+	d->lastnotify = clock_time();
 	list_add(sudevices, d);
 
+	//The pool holds fewer devices than the table, so there is always a free slot
+	uint8_t h = deviceHash(d->type, strlen(d->type));
+	uint8_t i = h & DEVICETABLE_MASK;
+	while(devslots[i].device != NULL){
+		i = (i + 1) & DEVICETABLE_MASK;
+	}
+	devslots[i].device = d;
+	devslots[i].hash = h;
+	devslots[i].len = strlen(d->type);
+
 	return d;
 }
 
@@ -169,35 +351,187 @@ susensors_next(susensors_sensor_t* s)
 	return list_item_next(s);
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * Queue an event from device s. Safe to call from interrupt context.
+ * The value is read from the driver before interrupts are disabled,
+ * only claiming the slot is done with them off.
+ * */
 void
 susensors_changed(susensors_sensor_t* s, uint8_t event)
 {
-	s->event_flag |= event;
-	process_post(&susensors_process, susensors_event_handle, s);
+	cmp_object_t value;
+	value.type = CMP_TYPE_NIL;
+	s->status(s, ActualValue, &value);
+	clock_time_t now = clock_time();
+
+	int_master_status_t status = int_master_read_and_disable();
+	uint8_t head = eventqueue_head;
+
+	if(((head + 1) & EVENTQUEUE_MASK) == eventqueue_tail){
+		eventqueue_dropped++;
+		int_master_status_set(status);
+		return;
+	}
+
+	suevent_t* e = &eventqueue[head];
+	e->device = s;
+	e->event = event;
+	e->timestamp = now;
+	e->value = value;
+
+	__sync_synchronize();	//The record must be complete before it is published
+	eventqueue_head = (head + 1) & EVENTQUEUE_MASK;
+	int_master_status_set(status);
+
+	process_poll(&susensors_process);
+}
+/*---------------------------------------------------------------------------*/
+/* The event being handled right now, NULL outside the event handling */
+const suevent_t*
+susensors_current_event(void)
+{
+	return current_event;
 }
 /*---------------------------------------------------------------------------*/
-susensors_sensor_t*
-susensors_find(const char *prefix, unsigned short len)
+/*
+ * Get the encoded value of the event being handled for device s.
+ * Used by the resource handler, so that observers are notified with
+ * the same value as the local pairs.
+ * Returns the payload length, or 0 if s has no event being handled
+ * */
+int
+susensors_snapshot(susensors_sensor_t* s, const uint8_t** payload)
 {
-	susensors_sensor_t* i;
+	if(current_event == NULL || current_event->device != s) return 0;
 
-	/* Search through all processes and search for the specified process
-     name. */
-	if(!len)
-		len = strlen(prefix);
+	*payload = snapshot;
+	return snapshotlen;
+}
+/*---------------------------------------------------------------------------*/
+/* Number of events lost because the queue was full */
+uint16_t
+susensors_events_dropped(void)
+{
+	return eventqueue_dropped;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Encode one entry of the readings map: the url of the device as key,
+ * and the actual value, or [value, eventstate] if withstate is set.
+ * A value that can not be read is sent as nil.
+ * Returns the length of the record
+ * */
+static int32_t
+readingEncode(susensors_sensor_t* d, uint8_t* record, uint32_t size, int withstate)
+{
+	struct mem_s mem;
+	cmp_ctx_t cmp;
+	cmp_object_t obj;
+	uint32_t namelen = strlen(d->type);
+
+	if(namelen > READINGS_NAME_MAXLEN) namelen = READINGS_NAME_MAXLEN;
+
+	mem_open(&mem, record, size);
+	cmp_init(&cmp, &mem, 0, mem_writer);
+	cmp_write_str(&cmp, d->type, namelen);
+	if(withstate){
+		cmp_write_array(&cmp, 2);
+	}
 
-	for(i = susensors_first(); i; i = susensors_next(i)) {
-		uint8_t su_url_len = strlen(i->type);
+	obj.type = CMP_TYPE_NIL;
+	if(d->status(d, ActualValue, &obj) != 0){
+		obj.type = CMP_TYPE_NIL;
+	}
+	cmp_write_object(&cmp, &obj);
 
-		if((su_url_len == len
-				|| (len > su_url_len
-						&& (((struct resourceconf*)(i->data.config))->flags & HAS_SUB_RESOURCES)
-						&& prefix[su_url_len] == '/'))
-				&& strncmp(prefix, i->type, su_url_len-1) == 0) {
+	if(withstate){
+		obj.type = CMP_TYPE_NIL;
+		if(d->suconfig(d, SUSENSORS_EVENTSTATE_GET, &obj) != 0){
+			obj.type = CMP_TYPE_NIL;
+		}
+		cmp_write_object(&cmp, &obj);
+	}
 
-			return i;
+	return mem_used(&mem, record);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Encode the actual value of every device as one map, url -> value.
+ * The map is made again for every block, and only the part from
+ * *offset is copied to buffer. A device keeps the type of its value,
+ * so the records keeps their length between the blocks.
+ * Returns the length put in buffer, less than len for the last block
+ * */
+int16_t
+susensors_readings(uint8_t* buffer, uint16_t len, int32_t *offset, int withstate)
+{
+	uint8_t record[READINGS_NAME_MAXLEN + 16];
+	int32_t pos = 0;
+	uint16_t ret = 0;
+	susensors_sensor_t* d = NULL;
+
+	for(int i=-1; ret < len; i++){
+		int32_t size;
+
+		if(i < 0){
+			struct mem_s mem;
+			cmp_ctx_t cmp;
+			mem_open(&mem, record, sizeof(record));
+			cmp_init(&cmp, &mem, 0, mem_writer);
+			cmp_write_map(&cmp, list_length(sudevices));
+			size = mem_used(&mem, record);
+			d = susensors_first();
+		}
+		else if(d != NULL){
+			size = readingEncode(d, record, sizeof(record), withstate);
+			d = susensors_next(d);
+		}
+		else{
+			break;
+		}
 
+		if(pos + size > *offset){
+			int32_t skip = *offset - pos;
+			int32_t n = size - skip;
+			if(n > len - ret) n = len - ret;
+
+			memcpy(buffer + ret, record + skip, n);
+			ret += n;
+			*offset += n;
 		}
+		pos += size;
+	}
+
+	return ret;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Find the device a request url points to. The url is hashed in one
+ * pass, and the index is probed where a device url could end, at each
+ * '/' and at the end of the url.
+ * sub is set to the sub resource (enum su_basic_events), noEvent if the
+ * url is the device itself. sub can be NULL.
+ * */
+susensors_sensor_t*
+susensors_find(const char *url, unsigned short len, uint8_t* sub)
+{
+	uint8_t h = 0;
+
+	if(!len)
+		len = strlen(url);
+
+	for(unsigned short n=0; n<=len; n++){
+		if(n == len || url[n] == '/'){
+			susensors_sensor_t* d = deviceSlot(url, n, h);
+			if(d != NULL){
+				int s = subResource(d, url + n, len - n);
+				if(s >= 0){
+					if(sub != NULL) *sub = s;
+					return d;
+				}
+			}
+		}
+		if(n < len) h = hashStep(h, url[n]);
 	}
 	return NULL;
 }
@@ -206,25 +540,20 @@ susensors_find(const char *prefix, unsigned short len)
 int missingJustCalled(uip_ip6addr_t* srcip){
 
 	int interested = 0;
-	//Go through all device pairs and trigger a new observe request
-	for(susensors_sensor_t *d = susensors_first(); d; d = susensors_next(d)) {
-		for(joinpair_t* i = list_head(d->pairs); i; i = list_item_next(i)){
-			int found = 1;
-			for(int j=0; j<8; j++){
-				if(srcip->u16[j] != i->destip.u16[j]){
-					found = 0;
-					break;
-				}
-			}
-			if(found){
-				interested = 1;
-				i->triggerindex = aboveEvent;
-				pairGroupRemove(i, aboveEvent);
-				pairGroupRemove(i, belowEvent);
-				pairGroupRemove(i, changeEvent);
-				process_post(&susensors_process, susensors_pair, i);
-			}
-		}
+	peer_t* peer = peerFind(srcip);
+	if(peer == NULL) return 0;
+
+	//Go through all the pairs to the node and trigger a new observe request
+	for(joinpair_t* i = peer->pairs; i; i = i->peernext){
+		interested = 1;
+		i->triggerindex = aboveEvent;
+		pairGroupRemove(i, aboveEvent);
+		pairGroupRemove(i, belowEvent);
+		pairGroupRemove(i, changeEvent);
+#if SUSENSORS_COMBINED_EVENTS
+		pairGroupRemove(i, combinedEvent);
+#endif
+		process_post(&susensors_process, susensors_pair, i);
 	}
 	return interested;
 }
@@ -248,6 +577,7 @@ static void notification_callback(coap_observee_t *obs, void *notification,
 		case NO_REPLY_FROM_SERVER:
 			process_post(&susensors_process, susensors_pair_fail, pair);
 			g->paired = 0;
+			g->obs = NULL;	//Removed by coap after this callback
 			break;
 		}
 	}
@@ -332,6 +662,50 @@ static void change_notificationcb(coap_observee_t *obs, void *notification,
 	}
 }
 
+/*
+ * Notification from the combined events stream. The payload is the
+ * mask of the events that fired followed by the value:
+ * 1. Event mask (SUSENSORS_xxx_EVENT bits)
+ * 2. Value of the event
+ * */
+static void events_notificationcb(coap_observee_t *obs, void *notification,
+		coap_notification_flag_t flag){
+	int len = 0;
+	const uint8_t *payload = NULL;
+	uint8_t mask;
+	uint32_t bufindex;
+	pairgroup_t* g = (pairgroup_t*) obs->data;
+
+	if(flag == NOTIFICATION_OK){
+
+		if(notification) {
+			len = coap_get_payload(notification, &payload);
+		}
+		if(len <= 0 || cp_decodeU8(payload, len, &mask, &bufindex) != 0) return;
+		payload += bufindex;
+		len -= bufindex;
+
+		for(pairgroupItem_t* i = list_head(g->pairgroup); i; i = list_item_next(i)){
+			joinpair_t* pair = i->pair;
+
+			susensors_sensor_t* this = (susensors_sensor_t*) pair->deviceptr;
+			//Only the events the pair was set up for
+			if((mask & SUSENSORS_CHANGE_EVENT) && pair->triggers[changeEvent] != -1 && pair->changeEventhandler != 0){
+				pair->changeEventhandler(this, len, payload);
+			}
+			if((mask & SUSENSORS_BELOW_EVENT) && pair->triggers[belowEvent] != -1 && pair->belowEventhandler != 0){
+				pair->belowEventhandler(this, len, payload);
+			}
+			if((mask & SUSENSORS_ABOVE_EVENT) && pair->triggers[aboveEvent] != -1 && pair->aboveEventhandler != 0){
+				pair->aboveEventhandler(this, len, payload);
+			}
+		}
+	}
+	else{
+		notification_callback(obs, notification, flag);
+	}
+}
+
 static void txPresence_cb(void *data, void *response){
 	revlookup_t* rl = (revlookup_t*) data;
 	coap_packet_t *const coap_res = (coap_packet_t *)response;
@@ -366,20 +740,73 @@ static void txPresence(revlookup_t* rl){
 	}
 }
 
+/* Subscribe a local pair to the device it points to */
 void localPairConnect(joinpair_t* pair){
 	if(pair->localdeviceptr != 0) return;
 	for(susensors_sensor_t* d = susensors_first(); d; d = susensors_next(d)){
-		if(strcmp((char*)MMEM_PTR(&pair->dsturl), d->type) == 0){
+		if(strcmp(pair->dsturl, d->type) == 0){
+			localpair_t* lp = poolAlloc(&localpairs_memb_pool);
+			if(lp == NULL) return;
+
+			lp->pair = pair;
+			list_add(d->localpairs, lp);
 			pair->localdeviceptr = d;
+			return;
 		}
 	}
 }
+#if SUSENSORS_COMBINED_EVENTS
+/* Setup all the event handlers of a remote pair at once, and
+ * observe the combined events stream of the remote device.
+ * Return 0 on finished else 1
+ * */
+static int setupCombinedConnection(joinpair_t* pair){
+	susensors_sensor_t* this = pair->deviceptr;
+
+	if(pair->triggerindex >= changeEvent){
+		pair->triggerindex = noEvent;
+		return 0;
+	}
+	pair->triggerindex = changeEvent;
+
+	if(this->setEventhandlers != 0){
+		if(pair->triggers[aboveEvent] != -1)
+			pair->aboveEventhandler = this->setEventhandlers(this, pair->triggers[aboveEvent]);
+		if(pair->triggers[belowEvent] != -1)
+			pair->belowEventhandler = this->setEventhandlers(this, pair->triggers[belowEvent]);
+		if(pair->triggers[changeEvent] != -1)
+			pair->changeEventhandler = this->setEventhandlers(this, pair->triggers[changeEvent]);
+	}
+
+	pairgroup_t* g = pairGroupAdd(pair, combinedEvent);
+	if(g == 0){
+		pair->triggerindex = noEvent;
+		return 0;
+	}
+	if(g->paired == 0){
+		g->paired = 1;
+		g->obs = coap_obs_request_registration(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), (char*)g->uri,
+				events_notificationcb, g);
+	}
+	else{
+		process_post(&susensors_process, susensors_pair, pair);
+	}
+	return 1;
+}
+#endif
+
 /* Go through all the devices and all the pairs
  * Return 0 on finished all pairs else 1
  * */
 static int setupPairsConnections(joinpair_t* pair){
 	susensors_sensor_t* this = pair->deviceptr;
 
+#if SUSENSORS_COMBINED_EVENTS
+	if(!pair->localhost){
+		return setupCombinedConnection(pair);
+	}
+#endif
+
 	if(pair->triggers[0] != -1 && pair->triggerindex < aboveEvent){	//Above
 		pair->triggerindex = aboveEvent;
 		if(this->setEventhandlers != 0)
@@ -391,9 +818,13 @@ static int setupPairsConnections(joinpair_t* pair){
 			}
 			else{
 				pairgroup_t* g = pairGroupAdd(pair, aboveEvent);
-				if(g->paired == 0){
+				if(g == 0){
+					//No room for the group, go on with the next event
+					process_post(&susensors_process, susensors_pair, pair);
+				}
+				else if(g->paired == 0){
 					g->paired = 1;
-					coap_obs_request_registration(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), pair->dsturlAbove,
+					g->obs = coap_obs_request_registration(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), (char*)g->uri,
 							above_notificationcb, g);
 				}
 				else{
@@ -414,9 +845,13 @@ static int setupPairsConnections(joinpair_t* pair){
 			}
 			else{
 				pairgroup_t* g = pairGroupAdd(pair, belowEvent);
-				if(g->paired == 0){
+				if(g == 0){
+					//No room for the group, go on with the next event
+					process_post(&susensors_process, susensors_pair, pair);
+				}
+				else if(g->paired == 0){
 					g->paired = 1;
-					coap_obs_request_registration(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), pair->dsturlBelow,
+					g->obs = coap_obs_request_registration(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), (char*)g->uri,
 						below_notificationcb, g);
 				}
 				else{
@@ -436,9 +871,13 @@ static int setupPairsConnections(joinpair_t* pair){
 			}
 			else{
 				pairgroup_t* g = pairGroupAdd(pair, changeEvent);
-				if(g->paired == 0){
+				if(g == 0){
+					//No room for the group, go on with the next event
+					process_post(&susensors_process, susensors_pair, pair);
+				}
+				else if(g->paired == 0){
 					g->paired = 1;
-					coap_obs_request_registration(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), pair->dsturlChange,
+					g->obs = coap_obs_request_registration(&pair->destip, UIP_HTONS(COAP_DEFAULT_PORT), (char*)g->uri,
 						change_notificationcb, g);
 				}
 				else{
@@ -456,69 +895,240 @@ static int setupPairsConnections(joinpair_t* pair){
 }
 
 void transactionAdd(process_event_t ev, process_data_t data, transaction_Priority_t priority, uip_ip6addr_t addr){
-	transaction_t* t = (transaction_t*)memb_alloc(&transactions_memb);
-	if(t == NULL) return;
+	transaction_t* t = (transaction_t*)poolAlloc(&transactions_memb_pool);
+	if(t == NULL){
+		txstats.dropped++;
+		PRINTF("Transaction queue full, dropped %u\n", txstats.dropped);
+		return;
+	}
+
+	if(priority >= TRANSACTION_PRIORITIES) priority = Priority_Low;
 
+	t->next = NULL;
 	t->ev = ev;
 	t->data = data;
 	t->priority = priority;
 	t->addr = addr;
 
-	transaction_t* next = NULL;
-	transaction_t* last = NULL;
-	if(list_length(transactions) > 0 && priority != Priority_Low){
-		for(transaction_t* i = list_head(transactions); i; i = list_item_next(i)){
-			next=list_item_next(i);
-			if(next == NULL){
-				if(i->priority > priority){
-					list_insert(transactions, last, t);
-					return;
+	struct transaction_fifo_s* q = &transactions[priority];
+	if(q->tail == NULL){
+		q->head = t;
+	}
+	else{
+		q->tail->next = t;
+	}
+	q->tail = t;
+
+	txstats.queued++;
+	if(txstats.queued > txstats.highwater){
+		txstats.highwater = txstats.queued;
+	}
+}
+
+/* Unlink t from its queue. prev is the transaction before t, or NULL if t is first */
+static void transactionUnlink(transaction_t* prev, transaction_t* t){
+	struct transaction_fifo_s* q = &transactions[t->priority];
+
+	if(prev == NULL){
+		q->head = t->next;
+	}
+	else{
+		prev->next = t->next;
+	}
+	if(q->tail == t){
+		q->tail = prev;
+	}
+
+	memb_free(&transactions_memb, t);
+	txstats.queued--;
+}
+
+/* Return the active slot of addr, or -1 if there is no active transaction for it */
+static int transactionActiveSlot(const uip_ip6addr_t* addr){
+	for(int i=0; i<MAX_ACTIVE_TRANSACTIONS; i++){
+		if(activeSlots[i].used && memcmp(addr, &activeSlots[i].addr, 16) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Start the first transaction in the queue, that is for a node
+ * without an active transaction.
+ * Returns 0 when nothing more can be started
+ * */
+int transactionStartNext(){
+	if(activeTransactions >= MAX_ACTIVE_TRANSACTIONS) return 0;
+
+	for(int p=0; p<TRANSACTION_PRIORITIES; p++){
+		transaction_t* prev = NULL;
+		for(transaction_t* t = transactions[p].head; t; prev = t, t = t->next){
+			if(transactionActiveSlot(&t->addr) >= 0) continue;
+
+			for(int i=0; i<MAX_ACTIVE_TRANSACTIONS; i++){
+				if(!activeSlots[i].used){
+					activeSlots[i].used = 1;
+					activeSlots[i].addr = t->addr;
+					activeSlots[i].data = t->data;
+					break;
 				}
 			}
-			else if(i->priority < priority && next->priority != priority){
-				list_insert(transactions, last, t);
-				return;
+			activeTransactions++;
+
+			process_post(&susensors_process, t->ev, t->data);
+			transactionUnlink(prev, t);
+
+			return MAX_ACTIVE_TRANSACTIONS - activeTransactions;
+		}
+	}
+
+	return 0;	//No more transactions that can be started
+}
+
+/*
+ * The transaction for data has finished. Only the slot started for
+ * data is freed, a pair or presence handled outside the queue does
+ * not free the slot of another transaction to the same node.
+ * */
+void transactionRemove(process_data_t data){
+	for(int i=0; i<MAX_ACTIVE_TRANSACTIONS; i++){
+		if(activeSlots[i].used && activeSlots[i].data == data){
+			activeSlots[i].used = 0;
+			activeTransactions--;
+			return;
+		}
+	}
+}
+
+/* The transaction for data failed, drop the other transactions for its node too */
+void transactionRemoveNode(process_data_t data, uip_ip6addr_t addr){
+	transactionRemove(data);
+	//Remove all other transactions for that node
+	for(int p=0; p<TRANSACTION_PRIORITIES; p++){
+		transaction_t* prev = NULL;
+		transaction_t* t = transactions[p].head;
+		while(t != NULL){
+			transaction_t* next = t->next;
+			if(memcmp(&addr, &t->addr, 16) == 0){
+				transactionUnlink(prev, t);
+			}
+			else{
+				prev = t;
 			}
-			last = i;
+			t = next;
 		}
 	}
+}
 
-	list_add(transactions, t);
+/* Usage of the transaction queue */
+const struct susensors_txstats_s*
+susensors_transaction_stats(void)
+{
+	return &txstats;
 }
 
-int transactionStartNext(){
-	if(activeTransactions < MAX_ACTIVE_TRANSACTIONS){
-		transaction_t* t = list_head(transactions);
-		if(t != NULL){
-			process_post(&susensors_process, t->ev, t->data);
-			list_remove(transactions, t);
-			memb_free(&transactions_memb, t);
-			activeTransactions++;
+static void handleEvent(const suevent_t* e){
+	susensors_sensor_t* d = e->device;
+	resource_t* resource = d->data.resource;
+
+	snapshotlen = cp_encodeObject(snapshot, (cmp_object_t*)&e->value);
+	current_event = e;
+
+	//Handle all remote pairs
+	if(resource != NULL){
+		if(e->event & SUSENSORS_CHANGE_EVENT){
+			coap_notify_observers_sub(resource, strChange);
 		}
-		else{
-			return 0;	//No more transactions in que
+		if(e->event & SUSENSORS_BELOW_EVENT){
+			coap_notify_observers_sub(resource, strBelow);
+		}
+		if(e->event & SUSENSORS_ABOVE_EVENT){
+			coap_notify_observers_sub(resource, strAbove);
+		}
+		if(e->event & (SUSENSORS_CHANGE_EVENT | SUSENSORS_BELOW_EVENT | SUSENSORS_ABOVE_EVENT)){
+			coap_notify_observers_sub(resource, strEvents);
 		}
 	}
 
-	return MAX_ACTIVE_TRANSACTIONS - activeTransactions;
+	//Handle all local pairs - no need to use CoAP for this
+	for(localpair_t* lp = list_head(d->localpairs); lp; lp = list_item_next(lp)){
+		joinpair_t* p = lp->pair;
+		susensors_sensor_t* dd = p->deviceptr;
+
+		if(e->event & SUSENSORS_CHANGE_EVENT){
+			if(p->triggers[changeEvent] != -1){
+				p->changeEventhandler(dd, snapshotlen, snapshot);
+			}
+		}
+		if(e->event & SUSENSORS_BELOW_EVENT){
+			if(p->triggers[belowEvent] != -1){
+				p->belowEventhandler(dd, snapshotlen, snapshot);
+			}
+		}
+		if(e->event & SUSENSORS_ABOVE_EVENT){
+			if(p->triggers[aboveEvent] != -1){
+				p->aboveEventhandler(dd, snapshotlen, snapshot);
+			}
+		}
+	}
+
+	current_event = NULL;
 }
 
-void transactionRemove(){
-	if(activeTransactions > 0){
-		activeTransactions--;
+/* The notify interval has passed, send the events collected meanwhile */
+static void flushPending(void* ptr){
+	susensors_sensor_t* d = (susensors_sensor_t*)ptr;
+
+	d->lastnotify = clock_time();
+	if(d->pending.event){
+		handleEvent(&d->pending);
+		d->pending.event = 0;
 	}
 }
 
-void transactionRemoveNode(uip_ip6addr_t addr){
-	transactionRemove();
-	//Remove all other transactions for that node
-	for(transaction_t* i = list_head(transactions); i; i = list_item_next(i)){
-		if(memcmp(&addr, &i->addr, 16) == 0){
-			list_remove(transactions, i);
-			memb_free(&transactions_memb, i);
-			i = list_head(transactions);
-		}
+/*
+ * Devices with a NotifyInterval will notify at most once per interval.
+ * Events arriving faster are merged, so that when the interval has
+ * passed, all the event types seen are notified with the latest value.
+ * An above and a below event are never merged, as one value can not be
+ * both. The pending event is sent first, with its own value.
+ * */
+#define THRESHOLD_EVENTS	(SUSENSORS_ABOVE_EVENT | SUSENSORS_BELOW_EVENT)
+
+static void rateLimitEvent(const suevent_t* e){
+	susensors_sensor_t* d = e->device;
+	settings_t* setting = d->data.setting;
+	clock_time_t interval;
+	clock_time_t now = clock_time();
+
+	if(setting == NULL || setting->NotifyInterval == 0){
+		handleEvent(e);
+		return;
 	}
+
+	interval = ((clock_time_t)setting->NotifyInterval * CLOCK_SECOND) / 1000;
+	if(d->pending.event == 0 && (clock_time_t)(now - d->lastnotify) >= interval){
+		d->lastnotify = now;
+		handleEvent(e);
+		return;
+	}
+
+	uint8_t pending = d->pending.event & THRESHOLD_EVENTS;
+	uint8_t crossed = e->event & THRESHOLD_EVENTS;
+	if(pending && crossed && pending != crossed){
+		ctimer_stop(&d->notifytimer);
+		flushPending(d);
+		now = d->lastnotify;	//The interval starts over from the flush
+	}
+
+	if(d->pending.event == 0){
+		ctimer_set(&d->notifytimer, interval - (clock_time_t)(now - d->lastnotify), flushPending, d);
+	}
+	d->pending.device = d;
+	d->pending.event |= e->event;
+	d->pending.value = e->value;
+	d->pending.timestamp = e->timestamp;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -538,8 +1148,6 @@ PROCESS_THREAD(susensors_process, ev, data)
 	susensors_new_observer= process_alloc_event();
 	susensors_txhandler = process_alloc_event();
 
-	susensors_event_handle = process_alloc_event();
-
 	//Register callbacks
 	register_new_observer_notify_callback(new_observer);
 	pair_register_add_callback(pair_added);
@@ -554,7 +1162,6 @@ PROCESS_THREAD(susensors_process, ev, data)
 	}
 
 	for(d = susensors_first(); d; d = susensors_next(d)) {
-		d->event_flag = 0;
 		d->configure(d, SUSENSORS_HW_INIT, 0);
 		d->configure(d, SUSENSORS_ACTIVE, 1);
 
@@ -571,6 +1178,9 @@ PROCESS_THREAD(susensors_process, ev, data)
 	//Begin the transactions
 	process_post(&susensors_process, susensors_txhandler, NULL);
 
+	//Events might have been queued before we were started
+	process_poll(&susensors_process);
+
 	while(1) {
 		PROCESS_WAIT_EVENT();
 
@@ -586,7 +1196,7 @@ PROCESS_THREAD(susensors_process, ev, data)
 			if(data != NULL){
 				printf("susensors_pair!\n");
 				if(setupPairsConnections(data) == 0){
-					transactionRemove();
+					transactionRemove(data);
 					process_post(&susensors_process, susensors_txhandler, NULL);
 				}
 			}
@@ -594,7 +1204,7 @@ PROCESS_THREAD(susensors_process, ev, data)
 		else if(ev == susensors_pair_fail){
 			printf("susensors_pair_fail!\n");
 			joinpair_t* pair = (joinpair_t*)data;
-			transactionRemoveNode(pair->destip);
+			transactionRemoveNode(pair, pair->destip);
 			process_post(&susensors_process, susensors_txhandler, NULL);
 		}
 
@@ -608,13 +1218,14 @@ PROCESS_THREAD(susensors_process, ev, data)
 		}
 		else if(ev == susensors_presence_success){
 			printf("susensors_presence_success!\n");
-			transactionRemove();
+			revlookup_t* rl = (revlookup_t*) data;
+			transactionRemove(rl);
 			process_post(&susensors_process, susensors_txhandler, NULL);
 		}
 		else if(ev == susensors_presence_fail){
 			printf("susensors_presence_fail!\n");
 			revlookup_t* rl = (revlookup_t*) data;
-			transactionRemoveNode(rl->srcip);
+			transactionRemoveNode(rl, rl->srcip);
 			process_post(&susensors_process, susensors_txhandler, NULL);
 		}
 
@@ -623,54 +1234,17 @@ PROCESS_THREAD(susensors_process, ev, data)
 			coap_observer_t *obs =  (coap_observer_t*) data;
 			revNotifyAdd(obs->addr);
 		}
-		else if(ev == susensors_event_handle){
-			d = (susensors_sensor_t*) data;
-			resource_t* resource = d->data.resource;
-
-			//Handle all remote pairs
-			if(resource != NULL){
-				if(d->event_flag & SUSENSORS_CHANGE_EVENT){
-					coap_notify_observers_sub(resource, strChange);
-				}
-				if(d->event_flag & SUSENSORS_BELOW_EVENT){
-					coap_notify_observers_sub(resource, strBelow);
-				}
-				if(d->event_flag & SUSENSORS_ABOVE_EVENT){
-					coap_notify_observers_sub(resource, strAbove);
-				}
+		else if(ev == PROCESS_EVENT_POLL){
+			int n = 0;
+			while(eventqueue_tail != eventqueue_head && n++ < EVENTQUEUE_BATCH){
+				rateLimitEvent(&eventqueue[eventqueue_tail]);
+				__sync_synchronize();
+				eventqueue_tail = (eventqueue_tail + 1) & EVENTQUEUE_MASK;
 			}
-
-			//Handle all local pairs - no need to use CoAP for this
-			for(susensors_sensor_t* dd = susensors_first(); dd; dd = susensors_next(dd)){
-				for(joinpair_t* p = list_head(dd->pairs); p; p = list_item_next(p)){
-					cmp_object_t obj;
-					uint8_t payload[10];
-					int len;
-
-					if(p->localhost && p->localdeviceptr == d){
-
-						d->status(d, ActualValue, &obj);
-						len = cp_encodeObject(payload, &obj);
-
-						if(d->event_flag & SUSENSORS_CHANGE_EVENT){
-							if(p->triggers[changeEvent] != -1){
-								p->changeEventhandler(dd, len, payload);
-							}
-						}
-						if(d->event_flag & SUSENSORS_BELOW_EVENT){
-							if(p->triggers[belowEvent] != -1){
-								p->belowEventhandler(dd, len, payload);
-							}
-						}
-						if(d->event_flag & SUSENSORS_ABOVE_EVENT){
-							if(p->triggers[aboveEvent] != -1){
-								p->aboveEventhandler(dd, len, payload);
-							}
-						}
-					}
-				}
+			//Let other processes run before handling the rest
+			if(eventqueue_tail != eventqueue_head){
+				process_poll(&susensors_process);
 			}
-			d->event_flag = SUSENSORS_NO_EVENT;
 		}
 	}
 	PROCESS_END();
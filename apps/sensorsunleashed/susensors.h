@@ -35,15 +35,30 @@
 
 #include "contiki.h"
 #include "lib/list.h"
+#include "sys/ctimer.h"
 #include "cmp_helpers.h"
 
 #define SU_VER_MAJOR	0	//Is increased when there has been changes to the protocol, which is not backwards compatible
-#define SU_VER_MINOR	0	//Is increased if the protocol is changed, but still backwards compatible
+#define SU_VER_MINOR	1	//Is increased if the protocol is changed, but still backwards compatible
 #define SU_VER_DEV		2	//Is increased for every minor fix
 
 #include "coap-observe-client.h"
 #define DEVICES_MAX		10
 
+/* Slots in the url index of the devices, a power of 2 larger than DEVICES_MAX */
+#ifdef SUSENSORS_CONF_DEVICETABLE_SIZE
+#define DEVICETABLE_SIZE	SUSENSORS_CONF_DEVICETABLE_SIZE
+#else
+#define DEVICETABLE_SIZE	16
+#endif
+
+#if DEVICETABLE_SIZE <= DEVICES_MAX
+#error "DEVICETABLE_SIZE must be larger than DEVICES_MAX, the probing needs a free slot"
+#endif
+#if DEVICETABLE_SIZE > 256 || (DEVICETABLE_SIZE & (DEVICETABLE_SIZE - 1)) != 0
+#error "DEVICETABLE_SIZE must be a power of 2, and max 256"
+#endif
+
 #define SUSENSORS_NO_EVENT		0
 #define SUSENSORS_ABOVE_EVENT	(1 << 1)	//2
 #define SUSENSORS_BELOW_EVENT	(1 << 2)	//4
@@ -53,6 +68,19 @@
 extern const char* strAbove;
 extern const char* strBelow;
 extern const char* strChange;
+extern const char* strEvents;
+
+/*
+ * When set, remote pairs subscribe to the combined events stream
+ * of the device they pair with, instead of one observe per event
+ * type. All pairs to the same remote device then share a single
+ * observe registration. The remote node must have SU_VER_MINOR >= 1
+ * */
+#ifdef SUSENSORS_CONF_COMBINED_EVENTS
+#define SUSENSORS_COMBINED_EVENTS	SUSENSORS_CONF_COMBINED_EVENTS
+#else
+#define SUSENSORS_COMBINED_EVENTS	0
+#endif
 
 typedef int (* eventhandler_ptr)(void* this, int len, const uint8_t* payload);
 
@@ -61,6 +89,7 @@ enum su_basic_events {
 	belowEvent,
 	changeEvent,
 	noEvent,
+	combinedEvent,	//Only used for grouping pairs on the combined events stream
 };
 enum su_basic_actions {
 	setOn,
@@ -84,6 +113,14 @@ enum susensors_configcmd {
 	SUSENSORS_RANGEMIN_GET,
 	SUSENSORS_EVENTSTATE_GET,
 	SUSENSORS_STORE_SETUP,
+	SUSENSORS_EVENTLIMITS_SET,
+	SUSENSORS_EVENTLIMITS_GET,
+};
+
+/* The received payload, given to suconfig with the _SET commands */
+struct supayload_s {
+	const uint8_t* data;
+	uint32_t len;
 };
 
 enum susensors_event_cmd {
@@ -97,13 +134,45 @@ enum susensors_event_cmd {
 #define SUSENSORS_ACTIVE 	129 /* ACTIVE => 0 -> turn off, 1 -> turn on */
 #define SUSENSORS_READY 	130 /* read only */
 
+/* 64bit integers and doubles makes every stored value twice as big,
+ * only enable them if a device needs them */
+#ifdef SUSENSORS_CONF_WIDE_VALUES
+#define SUSENSORS_WIDE_VALUES	SUSENSORS_CONF_WIDE_VALUES
+#else
+#define SUSENSORS_WIDE_VALUES	0
+#endif
+
+/*
+ * A device value in its native width. The cmp type is the same for
+ * all values of a device, so it is only stored once (settings_t valuetype),
+ * and the values are only converted to cmp_object_t when they are
+ * send or received.
+ * */
+union suvalue_u {
+	bool boolean;
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	int8_t s8;
+	int16_t s16;
+	int32_t s32;
+	float flt;
+#if SUSENSORS_WIDE_VALUES
+	uint64_t u64;
+	int64_t s64;
+	double dbl;
+#endif
+};
+typedef union suvalue_u suvalue_t;
+
 //TODO: Rename this to something common
 struct relayRuntime {
 	uint8_t enabled;
 	uint8_t hasEvent;
-	cmp_object_t LastEventValue;
-	cmp_object_t LastValue;
-	cmp_object_t ChangeEventAcc;	///Accumulated steps; for determining if event should be fired
+	uint8_t disarmed;				///Above/BelowEventActive bits of events waiting for the value to pass the hysteresis
+	suvalue_t LastEventValue;
+	suvalue_t LastValue;
+	uint32_t ChangeEventAcc;		///Accumulated steps; for determining if event should be fired
 };
 
 struct ledRuntime {
@@ -119,6 +188,23 @@ struct extras{
 	void* resource;		//Will contain the build resource from the config file
 };
 
+typedef uint64_t (* threshold_key_t)(const suvalue_t* v);
+
+/*
+ * The event thresholds converted into keys, that keeps the order of
+ * the values they came from. Built once when the settings are loaded
+ * or changed, so that checking a sample is only a few integer compares
+ * no matter the cmp type of the device.
+ * */
+struct threshold_s {
+	threshold_key_t key;	///Converts a device value into a key, NULL if type is not supported
+	uint64_t above;			///AboveEventAt as key
+	uint64_t below;			///BelowEventAt as key
+	uint64_t aboveRearm;	///Above event is armed again when the value is below this key
+	uint64_t belowRearm;	///Below event is armed again when the value is above this key
+	uint32_t change;		///ChangeEvent as a step count
+};
+
 struct storedSetting_s {
 	/* Pseudocode:
 	 *
@@ -137,21 +223,36 @@ struct storedSetting_s {
 	 * */
 	uint8_t cfs_file_id;		///The file id of the setup file from flash
 	uint8_t eventsActive;		///Generation of events on or Off (Determined by eventstate)
-	cmp_object_t AboveEventAt;	///When resource crosses this line from low to high give an event (>=)
-	cmp_object_t BelowEventAt;	///When resource crosses this line from high to low give an event (<=)
-    cmp_object_t ChangeEvent;	///When value has changed more than changeEvent + lastevent value <>= value
+	uint8_t valuetype;			///The cmp type of all the values below, and of the device itself
+	suvalue_t AboveEventAt;		///When resource crosses this line from low to high give an event (>=)
+	suvalue_t BelowEventAt;		///When resource crosses this line from high to low give an event (<=)
+    suvalue_t ChangeEvent;		///When value has changed more than changeEvent + lastevent value <>= value
 
-    cmp_object_t RangeMin;		///What is the minimum value this device can read
-    cmp_object_t RangeMax;		///What is the maximum value this device can read
+    suvalue_t RangeMin;			///What is the minimum value this device can read
+    suvalue_t RangeMax;			///What is the maximum value this device can read
+
+    suvalue_t Hysteresis;		///How far back the value has to go from Above/BelowEventAt, before they can fire again
+    uint16_t NotifyInterval;	///Minimum ms between two events; events in between are merged into one with the latest value
+
+    struct threshold_s threshold;	///Not stored - built from the above by thresholdNormalize()
 };
 typedef struct storedSetting_s settings_t;
 
+struct susensors_sensor;
+
+/* A single event, as captured when the device signaled it */
+struct suevent_s {
+	struct susensors_sensor* device;
+	uint8_t event;				//SUSENSORS_xxx_EVENT mask
+	cmp_object_t value;			//Device value at the time of the event
+	clock_time_t timestamp;		//clock_time() at the time of the event
+};
+typedef struct suevent_s suevent_t;
+
 struct susensors_sensor {
 	struct susensors_sensor* next;
 	char *       type;
 
-	unsigned char event_flag;
-
 	/* Set device values */
 	int (* value)     			(struct susensors_sensor* this, int type, void* data);
 	/* Get/set device hardware specific configuration */
@@ -169,19 +270,43 @@ struct susensors_sensor {
 	struct extras data;
 
 	LIST_STRUCT(pairs);
+	LIST_STRUCT(localpairs);	//Local pairs subscribing to events from this device
+
+	/* Used to keep the events at least NotifyInterval apart */
+	clock_time_t lastnotify;
+	suevent_t pending;
+	struct ctimer notifytimer;
 };
 
 typedef struct susensors_sensor susensors_sensor_t;
 
 void initSUSensors();
 susensors_sensor_t* addSUDevices(susensors_sensor_t* device);
-susensors_sensor_t* susensors_find(const char *type, unsigned short len);
+susensors_sensor_t* susensors_find(const char *url, unsigned short len, uint8_t* sub);
 susensors_sensor_t* susensors_next(susensors_sensor_t* s);
 susensors_sensor_t* susensors_first(void);
 
 int missingJustCalled(uip_ip6addr_t* srcip);
 
 void susensors_changed(susensors_sensor_t* s, uint8_t event);
+const suevent_t* susensors_current_event(void);
+int susensors_snapshot(susensors_sensor_t* s, const uint8_t** payload);
+uint16_t susensors_events_dropped(void);
+
+/* Longest device url in the readings map, longer ones are cut */
+#ifdef SUSENSORS_CONF_READINGS_NAME_MAXLEN
+#define READINGS_NAME_MAXLEN	SUSENSORS_CONF_READINGS_NAME_MAXLEN
+#else
+#define READINGS_NAME_MAXLEN	32
+#endif
+int16_t susensors_readings(uint8_t* buffer, uint16_t len, int32_t *offset, int withstate);
+
+struct susensors_txstats_s{
+	uint8_t queued;		//Transactions waiting in the queue
+	uint8_t highwater;	//Most transactions ever waiting at the same time
+	uint16_t dropped;	//Transactions lost because the queue was full
+};
+const struct susensors_txstats_s* susensors_transaction_stats(void);
 
 PROCESS_NAME(susensors_process);
 
@@ -0,0 +1,121 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#include <string.h>
+#include "contiki.h"
+#include "urltable.h"
+#include "slab.h"
+
+/* The strings are allocated from the slab, so they never move */
+struct urlentry_s{
+	char* str;			//NULL if the entry is free
+	uint8_t refs;
+	uint8_t hash;
+};
+
+static struct urlentry_s urls[URLS_MAX];
+
+static uint8_t urlHash(const char* url){
+	uint8_t h = 0;
+	while(*url){
+		h = (h << 3) + (h >> 5) + *url++;
+	}
+	return h;
+}
+
+static struct urlentry_s* urlEntry(const char* url){
+	for(int i=0; i<URLS_MAX; i++){
+		if(urls[i].str == url) return &urls[i];
+	}
+	return NULL;
+}
+
+void urlTableInit(){
+	memset(urls, 0, sizeof(urls));
+}
+
+//Return the shared copy of url, or NULL if there is no room for it
+const char* urlIntern(const char* url){
+	struct urlentry_s* unused = NULL;
+	uint16_t len = strlen(url) + 1;
+	uint8_t h = urlHash(url);
+
+	if(len > URL_MAXLEN) return NULL;
+
+	for(int i=0; i<URLS_MAX; i++){
+		struct urlentry_s* e = &urls[i];
+		if(e->str == NULL){
+			if(unused == NULL) unused = e;
+		}
+		else if(e->hash == h && strcmp(e->str, url) == 0){
+			e->refs++;
+			return e->str;
+		}
+	}
+
+	if(unused == NULL) return NULL;
+	unused->str = slab_alloc(len);
+	if(unused->str == NULL) return NULL;
+
+	memcpy(unused->str, url, len);
+	unused->refs = 1;
+	unused->hash = h;
+	return unused->str;
+}
+
+/* Write url with suffix appended to dst, which must hold URL_MAXLEN bytes.
+ * Return 0 on success */
+int urlBuild(char* dst, const char* url, const char* suffix){
+	int len = strlen(url);
+	int slen = strlen(suffix);
+	if(len + slen + 1 > URL_MAXLEN) return 1;
+
+	memcpy(dst, url, len);
+	memcpy(dst + len, suffix, slen + 1);
+	return 0;
+}
+
+//Return the shared copy of url with suffix appended, or NULL
+const char* urlInternSuffix(const char* url, const char* suffix){
+	char buf[URL_MAXLEN];
+	if(urlBuild(buf, url, suffix) != 0) return NULL;
+	return urlIntern(buf);
+}
+
+void urlRelease(const char* url){
+	struct urlentry_s* e = urlEntry(url);
+	if(e == NULL) return;
+	if(--e->refs > 0) return;
+
+	slab_free(e->str, strlen(e->str) + 1);
+	e->str = NULL;
+}
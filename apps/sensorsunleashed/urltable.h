@@ -0,0 +1,65 @@
+/*******************************************************************************
+ * Copyright (c) 2018, Ole Nissen.
+ *  All rights reserved. 
+ *  
+ *  Redistribution and use in source and binary forms, with or without 
+ *  modification, are permitted provided that the following conditions 
+ *  are met: 
+ *  1. Redistributions of source code must retain the above copyright 
+ *  notice, this list of conditions and the following disclaimer. 
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution. 
+ *  3. The name of the author may not be used to endorse or promote
+ *  products derived from this software without specific prior
+ *  written permission.  
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+ *  OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ *  GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ *  WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  
+ *
+ * This file is part of the Sensors Unleashed project
+ *******************************************************************************/
+
+#ifndef SENSORSUNLEASHED_URLTABLE_H_
+#define SENSORSUNLEASHED_URLTABLE_H_
+
+#include "contiki.h"
+#include "pairing.h"
+#include "pairgroup.h"
+
+/*
+ * Shared table of the destination urls used by the pairs.
+ * Pairs (and pair groups) pointing to the same url shares one
+ * copy of it, which is reference counted. The strings are allocated
+ * from the slab and never move, so the pointers can be handed to coap
+ * observe.
+ * */
+#ifdef URLTABLE_CONF_MAX
+#define URLS_MAX	URLTABLE_CONF_MAX
+#else
+#define URLS_MAX	(PAIRINGS_MAX + PAIRGROUPS_MAX)	//Base urls for the pairs plus the observed urls of the groups
+#endif
+
+#if URLS_MAX < PAIRINGS_MAX + PAIRGROUPS_MAX
+#error "URLS_MAX must hold the urls of all the pairs and pair groups"
+#endif
+
+#define URL_MAXLEN	100		//Including the terminator
+
+void urlTableInit();
+const char* urlIntern(const char* url);
+const char* urlInternSuffix(const char* url, const char* suffix);
+void urlRelease(const char* url);
+int urlBuild(char* dst, const char* url, const char* suffix);
+
+#endif /* SENSORSUNLEASHED_URLTABLE_H_ */
@@ -69,26 +69,12 @@ struct resourceconf pushbuttonconfig = {
 
 static const settings_t default_pushbutton_settings = {
 		.eventsActive = BelowEventActive,
-		.AboveEventAt = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 1
-		},
-		.BelowEventAt = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 0
-		},
-		.ChangeEvent = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 1
-		},
-		.RangeMin = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 0
-		},
-		.RangeMax = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 1
-		},
+		.valuetype = CMP_TYPE_UINT8,
+		.AboveEventAt.u8 = 1,
+		.BelowEventAt.u8 = 0,
+		.ChangeEvent.u8 = 1,
+		.RangeMin.u8 = 0,
+		.RangeMax.u8 = 1,
 };
 
 /*---------------------------------------------------------------------------*/
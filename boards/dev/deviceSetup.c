@@ -34,23 +34,59 @@
 #include "cfs.h"
 #include "cfs-coffee-arch.h"
 #include "deviceSetup.h"
+#include "susensorcommon.h"
 
 /*
+ * The values are stored as cmp objects, so that the files does not
+ * depend on how the values are kept in memory. Returns true on success
+ * */
+static bool readValue(cmp_ctx_t* cmp, uint8_t type, suvalue_t* v){
+	cmp_object_t obj;
+	if(!cmp_read_object(cmp, &obj)) return false;
+	if(obj.type == CMP_TYPE_NIL){		//Hysteresis was stored as nil when it was off
+		memset(v, 0, sizeof(suvalue_t));
+		return true;
+	}
+	return suvalueFromObject(type, v, &obj) == 0;
+}
+
+static bool writeValue(cmp_ctx_t* cmp, uint8_t type, const suvalue_t* v){
+	cmp_object_t obj;
+	suvalueToObject(type, v, &obj);
+	return cmp_write_object(cmp, &obj);
+}
+
+/*
+ * The event limits were added after the first setups were stored,
+ * so they are optional. If they are not in the file, the defaults
+ * are used.
  * return
  * 		 0: Found a file in flash
  * 		 1: No file in flash
  * */
-static int readSetup(cmp_ctx_t* cmp, settings_t* setup){
+static int readSetup(cmp_ctx_t* cmp, settings_t* setup, const settings_t* defaultsetting){
 	int ret = 1;
+	uint8_t type = defaultsetting->valuetype;
+	setup->valuetype = type;
 	do{
 		if(!cmp_read_u8(cmp, &setup->cfs_file_id)) break;
 		if(!cmp_read_u8(cmp, &setup->eventsActive)) break;
-		if(!cmp_read_object(cmp, &setup->AboveEventAt)) break;
-		if(!cmp_read_object(cmp, &setup->BelowEventAt)) break;
-		if(!cmp_read_object(cmp, &setup->ChangeEvent)) break;
-		if(!cmp_read_object(cmp, &setup->RangeMax)) break;
-		if(!cmp_read_object(cmp, &setup->RangeMin)) break;
+		if(!readValue(cmp, type, &setup->AboveEventAt)) break;
+		if(!readValue(cmp, type, &setup->BelowEventAt)) break;
+		if(!readValue(cmp, type, &setup->ChangeEvent)) break;
+		if(!readValue(cmp, type, &setup->RangeMax)) break;
+		if(!readValue(cmp, type, &setup->RangeMin)) break;
 		ret = 0;
+
+		setup->Hysteresis = defaultsetting->Hysteresis;
+		setup->NotifyInterval = defaultsetting->NotifyInterval;
+		if(!readValue(cmp, type, &setup->Hysteresis)) {
+			setup->Hysteresis = defaultsetting->Hysteresis;
+			break;
+		}
+		if(!cmp_read_u16(cmp, &setup->NotifyInterval)) {
+			setup->NotifyInterval = defaultsetting->NotifyInterval;
+		}
 	}while(0);
 	return ret;
 }
@@ -65,11 +101,13 @@ static int writeSetup(cmp_ctx_t* cmp, settings_t* setup, uint8_t newid){
 	do{
 		if(!cmp_write_u8(cmp, newid)) break;
 		if(!cmp_write_u8(cmp, setup->eventsActive)) break;
-		if(!cmp_write_object(cmp, &setup->AboveEventAt)) break;
-		if(!cmp_write_object(cmp, &setup->BelowEventAt)) break;
-		if(!cmp_write_object(cmp, &setup->ChangeEvent)) break;
-		if(!cmp_write_object(cmp, &setup->RangeMax)) break;
-		if(!cmp_write_object(cmp, &setup->RangeMin)) break;
+		if(!writeValue(cmp, setup->valuetype, &setup->AboveEventAt)) break;
+		if(!writeValue(cmp, setup->valuetype, &setup->BelowEventAt)) break;
+		if(!writeValue(cmp, setup->valuetype, &setup->ChangeEvent)) break;
+		if(!writeValue(cmp, setup->valuetype, &setup->RangeMax)) break;
+		if(!writeValue(cmp, setup->valuetype, &setup->RangeMin)) break;
+		if(!writeValue(cmp, setup->valuetype, &setup->Hysteresis)) break;
+		if(!cmp_write_u16(cmp, setup->NotifyInterval)) break;
 		ret = 0;
 	}while(0);
 
@@ -97,7 +135,7 @@ static int writeSetup(cmp_ctx_t* cmp, settings_t* setup, uint8_t newid){
  * 		 0: Found a file in flash and uses it
  * 		 1: No file in flash, use the default
  * */
-int deviceSetupGet(const char* devicename, settings_t* setupA, const settings_t* defaultsetting){
+static int deviceSetupRead(const char* devicename, settings_t* setupA, const settings_t* defaultsetting){
 
 	settings_t setupB;
 	struct file_s read;
@@ -113,8 +151,7 @@ int deviceSetupGet(const char* devicename, settings_t* setupA, const settings_t*
 	sprintf(filenameB, "setupB_%s", devicename);
 
 	//Read fileA if any
-	read.fd = cfs_open(filenameA, CFS_READ);
-	read.offset = 0;
+	file_open(&read, filenameA, CFS_READ);
 
 	do{
 		if(read.fd < 0) break;
@@ -122,13 +159,12 @@ int deviceSetupGet(const char* devicename, settings_t* setupA, const settings_t*
 		cmp_ctx_t cmp;
 		cmp_init(&cmp, &read, file_reader, file_writer);
 
-		retA = readSetup(&cmp, setupA);
+		retA = readSetup(&cmp, setupA, defaultsetting);
 
-		cfs_close(read.fd);
+		file_close(&read);
 	}while(0);
 
-	read.fd = cfs_open(filenameB, CFS_READ);
-	read.offset = 0;
+	file_open(&read, filenameB, CFS_READ);
 
 	//Read fileB if any
 	do{
@@ -137,9 +173,9 @@ int deviceSetupGet(const char* devicename, settings_t* setupA, const settings_t*
 		cmp_ctx_t cmp;
 		cmp_init(&cmp, &read, file_reader, file_writer);
 
-		retB = readSetup(&cmp, &setupB);
+		retB = readSetup(&cmp, &setupB, defaultsetting);
 
-		cfs_close(read.fd);
+		file_close(&read);
 	}while(0);
 
 
@@ -174,6 +210,14 @@ int deviceSetupGet(const char* devicename, settings_t* setupA, const settings_t*
 	return 1;
 }
 
+int deviceSetupGet(const char* devicename, settings_t* setup, const settings_t* defaultsetting){
+	int ret = deviceSetupRead(devicename, setup, defaultsetting);
+	if(ret >= 0){
+		thresholdNormalize(setup);
+	}
+	return ret;
+}
+
 /*
  * Store the current setup. Delete the oldest
  * version of the setup file, so that there is
@@ -198,54 +242,50 @@ int deviceSetupSave(const char* devicename, settings_t* setup){
 	sprintf(filenameA, "setupA_%s", devicename);
 	sprintf(filenameB, "setupB_%s", devicename);
 
-	write.fd = cfs_open(filenameA, CFS_READ);
-	write.offset = 0;
+	file_open(&write, filenameA, CFS_READ);
 
 	do{
 		if(write.fd < 0) break;
 
 		cmp_init(&cmp, &write, file_reader, file_writer);
 
-		retA = readSetup(&cmp, &setupX);
+		retA = readSetup(&cmp, &setupX, setup);
 
-		cfs_close(write.fd);
+		file_close(&write);
 	}while(0);
 
 	if(retA == 0 && setupX.cfs_file_id == setup->cfs_file_id){
 		//The current Active file is filenameA, erase and re-write filenameB
 		cfs_remove(filenameB);
 
-		if(cfs_coffee_reserve(filenameB, 30) != 0) return -1;	//The maximum length is 29 bytes, including overhead
-
-		write.fd = cfs_open(filenameB, CFS_READ | CFS_WRITE);
-		write.offset = 0;
+		if(cfs_coffee_reserve(filenameB, 40) != 0) return -1;	//The maximum length is 37 bytes with 32bit values, including overhead
 
+		file_open(&write, filenameB, CFS_READ | CFS_WRITE);
 
 		cmp_init(&cmp, &write, NULL, file_writer);
-		if(writeSetup(&cmp, setup, setup->cfs_file_id + 1) == 0){
+		if(writeSetup(&cmp, setup, setup->cfs_file_id + 1) == 0 && file_flush(&write) == 0){
 			setup->cfs_file_id += 1;
-			cfs_close(write.fd);
+			file_close(&write);
 			return 0;
 		}
-		cfs_close(write.fd);
+		file_close(&write);
 		return -3;
 	}
 
 	//The current Active file is filenameB, erase and re-write filenameA
 	cfs_remove(filenameA);
 
-	if(cfs_coffee_reserve(filenameA, 30) != 0) return -1;	//The maximum length is 29 bytes, including overhead
+	if(cfs_coffee_reserve(filenameA, 40) != 0) return -1;	//The maximum length is 37 bytes with 32bit values, including overhead
 
-	write.fd = cfs_open(filenameA, CFS_READ | CFS_WRITE);
-	write.offset = 0;
+	file_open(&write, filenameA, CFS_READ | CFS_WRITE);
 
 	cmp_init(&cmp, &write, NULL, file_writer);
-	if(writeSetup(&cmp, setup, setup->cfs_file_id + 1) == 0){
+	if(writeSetup(&cmp, setup, setup->cfs_file_id + 1) == 0 && file_flush(&write) == 0){
 		setup->cfs_file_id += 1;
-		cfs_close(write.fd);
+		file_close(&write);
 		return 0;
 	}
-	cfs_close(write.fd);
+	file_close(&write);
 
 	return 0;
 }
@@ -70,26 +70,14 @@ struct resourceconf mainsdetectconfig = {
 
 static const settings_t default_mainsDetector_settings = {
 		.eventsActive = AboveEventActive | BelowEventActive | ChangeEventActive,
-		.AboveEventAt = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 1
-		},
-		.BelowEventAt = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 0
-		},
-		.ChangeEvent = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 1
-		},
-		.RangeMin = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 0
-		},
-		.RangeMax = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 1
-		},
+		.valuetype = CMP_TYPE_UINT8,
+		.AboveEventAt.u8 = 1,
+		.BelowEventAt.u8 = 0,
+		.ChangeEvent.u8 = 1,
+		.RangeMin.u8 = 0,
+		.RangeMax.u8 = 1,
+		.Hysteresis.u8 = 0,
+		.NotifyInterval = 500,	//ms
 };
 
 static int get(struct susensors_sensor* this, int type, void* data)
@@ -98,7 +86,7 @@ static int get(struct susensors_sensor* this, int type, void* data)
 	cmp_object_t* obj = (cmp_object_t*)data;
 	if((enum up_parameter) type == ActualValue){
 		struct relayRuntime* r = (struct relayRuntime*)this->data.runtime;
-		*obj = r->LastValue;
+		suvalueToObject(CMP_TYPE_UINT8, &r->LastValue, obj);
 		ret = 0;
 	}
 	return ret;
@@ -215,10 +203,10 @@ void mainsdetect_pulsecnt_isr(){
 	leds_on(LEDS_GREEN);
 
 	struct relayRuntime* r = (struct relayRuntime*)mainsdetect->data.runtime;
-	if(r->LastValue.as.u8 == 0){
-		r->LastValue.as.u8 = 1;
+	if(r->LastValue.u8 == 0){
+		r->LastValue.u8 = 1;
 		leds_on(LEDS_GREEN);
-		setEventU8(mainsdetect, 1, 1);
+		setEvent(mainsdetect, 1, 1);
 	}
 
 	REG(GPT_2_BASE + GPTIMER_TBV) = TICKTIMEOUT;
@@ -243,10 +231,10 @@ void mainsdetect_mainsgone_isr(){
 	}
 
 	struct relayRuntime* r = (struct relayRuntime*)mainsdetect->data.runtime;
-	if(r->LastValue.as.u8 == 1){
+	if(r->LastValue.u8 == 1){
 		leds_off(LEDS_GREEN);
-		r->LastValue.as.u8 = 0;
-		setEventU8(mainsdetect, -1, 1);
+		r->LastValue.u8 = 0;
+		setEvent(mainsdetect, -1, 1);
 	}
 
 	//Clear the interrupts
@@ -273,9 +261,8 @@ susensors_sensor_t* addASUMainsDetector(const char* name, settings_t* settings){
 
 	mainsdetectruntime[0].enabled = 0;
 	mainsdetectruntime[0].hasEvent = 0,
-			mainsdetectruntime[0].LastEventValue.type = CMP_TYPE_UINT8;
-	mainsdetectruntime[0].LastEventValue.as.u8 = 0;
-	mainsdetectruntime[0].ChangeEventAcc.as.u8 = 0;
+	mainsdetectruntime[0].LastEventValue.u8 = 0;
+	mainsdetectruntime[0].ChangeEventAcc = 0;
 	d.data.runtime = (void*) &mainsdetectruntime[0];
 
 	return addSUDevices(&d);
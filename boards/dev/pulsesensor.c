@@ -68,26 +68,14 @@ struct resourceconf pulseconfig = {
 
 static const settings_t default_pulseCounter_settings = {
 		.eventsActive = ChangeEventActive,
-		.AboveEventAt = {
-				.type = CMP_TYPE_UINT16,
-				.as.u16 = 1000
-		},
-		.BelowEventAt = {
-				.type = CMP_TYPE_UINT16,
-				.as.u16 = 0
-		},
-		.ChangeEvent = {
-				.type = CMP_TYPE_UINT16,
-				.as.u16 = 200
-		},
-		.RangeMin = {
-				.type = CMP_TYPE_UINT16,
-				.as.u16 = 0
-		},
-		.RangeMax = {
-				.type = CMP_TYPE_UINT16,
-				.as.u16 = 65400
-		},
+		.valuetype = CMP_TYPE_UINT16,
+		.AboveEventAt.u16 = 1000,
+		.BelowEventAt.u16 = 0,
+		.ChangeEvent.u16 = 200,
+		.RangeMin.u16 = 0,
+		.RangeMax.u16 = 65400,
+		.Hysteresis.u16 = 0,
+		.NotifyInterval = 1000,	//ms
 };
 
 /**
@@ -168,10 +156,10 @@ static int configure(struct susensors_sensor* this, int type, int value)
 
 		/* 6. Load the timer start value into the GPTM Timer n Interval Load (GPTIMER_TnILR) registe */
 		/* When the timer is counting up, this register sets the upper bound for the timeout event. */
-		REG(GPT_1_BASE + GPTIMER_TAILR) = config->RangeMax.as.u16 - 1; //config->ChangeEvent.as.u16;	//When reached, its starts over from 0
+		REG(GPT_1_BASE + GPTIMER_TAILR) = config->RangeMax.u16 - 1; //config->ChangeEvent.u16;	//When reached, its starts over from 0
 
 		/* 7. Load the event count into the GPTM Timer n Match (GPTIMER_TnMATCHR) register. */
-		REG(GPT_1_BASE + GPTIMER_TAMATCHR) = config->ChangeEvent.as.u16 - 1;
+		REG(GPT_1_BASE + GPTIMER_TAMATCHR) = config->ChangeEvent.u16 - 1;
 
 		/* 8. If interrupts are required, set the CnMIM bit in the GPTM Interrupt Mask (GPTIMER_IMR) register. */
 		//REG(GPT_1_BASE + GPTIMER_IMR) |= (GPTIMER_IMR_CAMIM + GPTIMER_IMR_TATOIM);
@@ -223,9 +211,8 @@ susensors_sensor_t* addASUPulseInputRelay(const char* name, settings_t* settings
 
 	pulseinputruntime[0].enabled = 0;
 	pulseinputruntime[0].hasEvent = 0,
-	pulseinputruntime[0].LastEventValue.type = CMP_TYPE_UINT8;
-	pulseinputruntime[0].LastEventValue.as.u8 = 0;
-	pulseinputruntime[0].ChangeEventAcc.as.u8 = 0;
+	pulseinputruntime[0].LastEventValue.u16 = 0;
+	pulseinputruntime[0].ChangeEventAcc = 0;
 	d.data.runtime = (void*) &pulseinputruntime[0];
 
 	pulsesensor = addSUDevices(&d);
@@ -247,8 +234,8 @@ void pulscounter_isr(){
 
 		//Set the next compare to the next interval.
 		cmpreg = REG_H(GPT_1_BASE + GPTIMER_TAMATCHR);
-		cmpreg += config->ChangeEvent.as.u16;
-		cmpreg = cmpreg >= config->RangeMax.as.u16 ? cmpreg - config->RangeMax.as.u16 : cmpreg;
+		cmpreg += config->ChangeEvent.u16;
+		cmpreg = cmpreg >= config->RangeMax.u16 ? cmpreg - config->RangeMax.u16 : cmpreg;
 		REG(GPT_1_BASE + GPTIMER_TAMATCHR) = (uint16_t)cmpreg;
 	}
 	process_poll(&pulseinput_int_process);
@@ -273,16 +260,16 @@ PROCESS_THREAD(pulseinput_int_process, ev, data)
 		uint16_t val = (uint16_t) REG(GPT_1_BASE + GPTIMER_TAR) + 1;
 		uint16_t step = 0;
 
-		if(r->LastValue.as.u16 > val){	//Roll over
-			step = config->RangeMax.as.u16 - r->LastValue.as.u16 + val;
+		if(r->LastValue.u16 > val){	//Roll over
+			step = config->RangeMax.u16 - r->LastValue.u16 + val;
 		}
 		else{
-			step = val - r->LastValue.as.u16;
+			step = val - r->LastValue.u16;
 		}
 
-		r->LastValue.as.u16 = val;
+		r->LastValue.u16 = val;
 
-		setEventU16(pulsesensor, 1, step);
+		setEvent(pulsesensor, 1, step);
 	}
 
 	PROCESS_END();
@@ -65,26 +65,12 @@ struct resourceconf relayconfig = {
 
 static const settings_t default_relaysetting = {
 		.eventsActive = AboveEventActive | BelowEventActive | ChangeEventActive,
-		.AboveEventAt = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 1
-		},
-		.BelowEventAt = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 0
-		},
-		.ChangeEvent = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 1
-		},
-		.RangeMin = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 0
-		},
-		.RangeMax = {
-				.type = CMP_TYPE_UINT8,
-				.as.u8 = 1
-		},
+		.valuetype = CMP_TYPE_UINT8,
+		.AboveEventAt.u8 = 1,
+		.BelowEventAt.u8 = 0,
+		.ChangeEvent.u8 = 1,
+		.RangeMin.u8 = 0,
+		.RangeMax.u8 = 1,
 };
 
 /*---------------------------------------------------------------------------*/
@@ -100,8 +86,8 @@ static const settings_t default_relaysetting = {
 static int relay_on(struct susensors_sensor* this)
 {
 	struct relayRuntime* r = (struct relayRuntime*)this->data.runtime;
-	if(r->LastValue.as.u8 == 0){
-		r->LastValue.as.u8 = 1;
+	if(r->LastValue.u8 == 0){
+		r->LastValue.u8 = 1;
 		GPIO_SET_PIN(RELAY_PORT_BASE, RELAY_PIN_MASK);
 		return 0;
 	}
@@ -119,8 +105,8 @@ static int relay_on(struct susensors_sensor* this)
 static int relay_off(struct susensors_sensor* this)
 {
 	struct relayRuntime* r = (struct relayRuntime*)this->data.runtime;
-	if(r->LastValue.as.u8 == 1){
-		r->LastValue.as.u8 = 0;
+	if(r->LastValue.u8 == 1){
+		r->LastValue.u8 = 0;
 		GPIO_CLR_PIN(RELAY_PORT_BASE, RELAY_PIN_MASK);
 		return 0;
 	}
@@ -147,23 +133,23 @@ static int set(struct susensors_sensor* this, int type, void* data)
 	int ret = 1;
 	if((su_relay_actions)type == setOff && enabled){
 		if((ret = relay_off(this)) == 0){	//The relay changed from 1 -> 0
-			setEventU8(this, -1, 1);
+			setEvent(this, -1, 1);
 		}
 	}
 	else if((su_relay_actions)type == setOn && enabled){
 		if((ret = relay_on(this)) == 0){	//The relay changed from 0 -> 1
-			setEventU8(this, 1, 1);
+			setEvent(this, 1, 1);
 		}
 	}
 	else if((su_relay_actions)type == setToggle && enabled){
 		if(GPIO_READ_PIN(RELAY_PORT_BASE, RELAY_PIN_MASK) > 0){
 			if((ret = relay_off(this)) == 0){
-				setEventU8(this, -1, 1);
+				setEvent(this, -1, 1);
 			}
 		}
 		else{
 			if((ret = relay_on(this)) == 0){
-				setEventU8(this, 1, 1);
+				setEvent(this, 1, 1);
 			}
 		}
 	}
@@ -252,9 +238,8 @@ susensors_sensor_t* addASURelay(const char* name, settings_t* settings){
 
 	relayruntime[noofrelays].enabled = 0;
 	relayruntime[noofrelays].hasEvent = 0,
-	relayruntime[noofrelays].LastEventValue.type = CMP_TYPE_UINT8;
-	relayruntime[noofrelays].LastEventValue.as.u8 = 0;
-	relayruntime[noofrelays].ChangeEventAcc.as.u8 = 0;
+	relayruntime[noofrelays].LastEventValue.u8 = 0;
+	relayruntime[noofrelays].ChangeEventAcc = 0;
 	d.data.runtime = (void*) &relayruntime[noofrelays++];
 
 	return addSUDevices(&d);
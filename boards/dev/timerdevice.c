@@ -54,35 +54,22 @@ struct resourceconf timerconfig = {
 
 static const settings_t default_timer_settings = {
 		.eventsActive = AboveEventActive | BelowEventActive,
-		.AboveEventAt = {
-				.type = CMP_TYPE_UINT32,
-				.as.u32 = 60
-		},
-		.BelowEventAt = {
-				.type = CMP_TYPE_UINT32,
-				.as.u32 = 2
-		},
-		.ChangeEvent = {
-				.type = CMP_TYPE_UINT32,
-				.as.u32 = 2
-		},
-		.RangeMin = {
-				.type = CMP_TYPE_UINT32,
-				.as.u32 = 1
-		},
-		.RangeMax = {
-				.type = CMP_TYPE_UINT32,
-				.as.u32 = 30000000,	//Seconds (347,2 days)
-		},
+		.valuetype = CMP_TYPE_UINT32,
+		.AboveEventAt.u32 = 60,
+		.BelowEventAt.u32 = 2,
+		.ChangeEvent.u32 = 2,
+		.RangeMin.u32 = 1,
+		.RangeMax.u32 = 30000000,	//Seconds (347,2 days),
 };
 
 
 struct timerRuntime {
 	uint8_t enabled;
 	uint8_t hasEvent;
-	cmp_object_t LastEventValue;
-	cmp_object_t LastValue;
-	cmp_object_t ChangeEventAcc;	///Accumulated steps; for determining if event should be fired
+	uint8_t disarmed;
+	suvalue_t LastEventValue;
+	suvalue_t LastValue;
+	uint32_t ChangeEventAcc;		///Accumulated steps; for determining if event should be fired
 
 	/* Extra specific to device */
 	clock_time_t step;
@@ -131,10 +118,11 @@ static int set (susensors_sensor_t* this, int type, void* data){
 	}
 	else if((enum su_timer_actions)type == timerRestart){
 		ctimer_stop(&tr->timer);
-		tr->LastEventValue.as.u32 = r->BelowEventAt.as.u32 + 1;
-		int step = tr->LastValue.as.u32;
-		tr->LastValue.as.u32 = 0;
-		setEventU32(this, -1, step);
+		tr->LastEventValue.u32 = r->BelowEventAt.u32 + 1;
+		tr->disarmed &= ~BelowEventActive;
+		int step = tr->LastValue.u32;
+		tr->LastValue.u32 = 0;
+		setEvent(this, -1, step);
 		setNextTimeout(this);
 		ret = 0;
 	}
@@ -149,18 +137,18 @@ static int setNextTimeout(susensors_sensor_t* this){
 
 	clock_time_t interval = 0;
 	tr->step = 0;
-	if(tr->ChangeEventAcc.as.u32 <= r->ChangeEvent.as.u32 && (r->eventsActive & ChangeEventActive)){
-		interval = (clock_time_t)(r->ChangeEvent.as.u32 - tr->ChangeEventAcc.as.u32);
-		tr->step = interval == 0 ? r->ChangeEvent.as.u32 : interval;
+	if(tr->ChangeEventAcc <= r->ChangeEvent.u32 && (r->eventsActive & ChangeEventActive)){
+		interval = (clock_time_t)(r->ChangeEvent.u32 - tr->ChangeEventAcc);
+		tr->step = interval == 0 ? r->ChangeEvent.u32 : interval;
 	}
 
-	if(tr->LastValue.as.u32 < r->BelowEventAt.as.u32 && (r->eventsActive & BelowEventActive)){
-		interval = (clock_time_t)(r->BelowEventAt.as.u32 + 1 - tr->LastValue.as.u32);
+	if(tr->LastValue.u32 < r->BelowEventAt.u32 && (r->eventsActive & BelowEventActive)){
+		interval = (clock_time_t)(r->BelowEventAt.u32 + 1 - tr->LastValue.u32);
 		tr->step = (tr->step == 0 || interval < tr->step) ? interval : tr->step;
 	}
 
-	if(tr->LastValue.as.u32 < r->AboveEventAt.as.u32 && (r->eventsActive & AboveEventActive)){
-		interval = (clock_time_t)(r->AboveEventAt.as.u32 - tr->LastValue.as.u32);
+	if(tr->LastValue.u32 < r->AboveEventAt.u32 && (r->eventsActive & AboveEventActive)){
+		interval = (clock_time_t)(r->AboveEventAt.u32 - tr->LastValue.u32);
 		tr->step = (tr->step == 0 || interval < tr->step) ? interval : tr->step;
 	}
 
@@ -175,8 +163,8 @@ static void timer_cb(void* ptr){
 	susensors_sensor_t* this = ptr;
 	struct timerRuntime* tr = this->data.runtime;
 
-	tr->LastValue.as.u32 += tr->step;
-	setEventU32(this, 1, tr->step);
+	tr->LastValue.u32 += tr->step;
+	setEvent(this, 1, tr->step);
 
 	/* Set events */
 	setNextTimeout(this);
@@ -190,8 +178,6 @@ static int configure(susensors_sensor_t* this, int type, int value){
 		break;
 	case SUSENSORS_ACTIVE:
 		if(value){	//Activate
-			tr->LastValue.type = CMP_TYPE_UINT32;
-			tr->ChangeEventAcc.type = CMP_TYPE_UINT32;
 			tr->enabled = 1;
 			set(this, timerRestart, NULL);
 		}
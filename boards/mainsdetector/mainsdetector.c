@@ -33,6 +33,7 @@
 #include "contiki.h"
 #include "dev/leds.h"
 #include "susensors.h"
+#include "poolstats.h"
 #include "susensorcommon.h"
 #include "mainsdetect.h"
 #include "resources/res-susensors.h"
@@ -57,7 +58,7 @@ AUTOSTART_PROCESSES(&device_process);
 extern  resource_t  res_sysinfo;
 
 process_event_t systemchange;
-MEMB(settings_memb, settings_t, 1);
+POOL(settings_memb, settings_t, 1);
 
 PROCESS_THREAD(device_process, ev, data)
 {
@@ -67,7 +68,7 @@ PROCESS_THREAD(device_process, ev, data)
 
 	initSUSensors();
 
-	settings_t* mainsDetector_settings = (settings_t*)memb_alloc(&settings_memb);
+	settings_t* mainsDetector_settings = (settings_t*)poolAlloc(&settings_memb_pool);
 
 	susensors_sensor_t* d;
 	d = addASUMainsDetector(MAINSDETECT_ACTUATOR, mainsDetector_settings);
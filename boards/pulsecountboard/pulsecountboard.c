@@ -33,6 +33,7 @@
 #include "contiki.h"
 #include "dev/leds.h"
 #include "susensors.h"
+#include "poolstats.h"
 #include "susensorcommon.h"
 #include "button-sensor.h"
 #include "ledindicator.h"
@@ -62,7 +63,7 @@ struct ledRuntime led_yellow = { LEDS_YELLOW };
 extern  resource_t  res_sysinfo;
 
 process_event_t systemchange;
-MEMB(settings_memb, settings_t, 10);
+POOL(settings_memb, settings_t, 10);
 
 PROCESS_THREAD(device_process, ev, data)
 {
@@ -72,10 +73,10 @@ PROCESS_THREAD(device_process, ev, data)
 
 	initSUSensors();
 
-	settings_t* yellow_led_setting = (settings_t*)memb_alloc(&settings_memb);
-	settings_t* pulseCounter_settings = (settings_t*)memb_alloc(&settings_memb);
-	settings_t* pushbutton_settings = (settings_t*)memb_alloc(&settings_memb);
-	settings_t* timer_settings = (settings_t*)memb_alloc(&settings_memb);
+	settings_t* yellow_led_setting = (settings_t*)poolAlloc(&settings_memb_pool);
+	settings_t* pulseCounter_settings = (settings_t*)poolAlloc(&settings_memb_pool);
+	settings_t* pushbutton_settings = (settings_t*)poolAlloc(&settings_memb_pool);
+	settings_t* timer_settings = (settings_t*)poolAlloc(&settings_memb_pool);
 
 	susensors_sensor_t* d;
 	d = addASULedIndicator("su/led_yellow", yellow_led_setting, &led_yellow);
@@ -44,9 +44,6 @@
 //Enable uart receive
 #define UART0_CONF_WITH_INPUT	1
 
-/* Pre-allocated memory for loadable modules heap space (in bytes)*/
-#define MMEM_CONF_SIZE 512
-
 /* Enable client-side support for COAP observe */
 #define COAP_OBSERVE_CLIENT 1
 